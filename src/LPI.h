@@ -5,6 +5,8 @@
 
 // Data types and function prototypes
 
+// Hidden lengths of Fortran character arguments
+#define USE_FC_LEN_T
 #include <R.h>
 #include <math.h>
 #include <stdint.h>
@@ -13,55 +15,205 @@
 #include <R_ext/Rdynload.h>
 #include <R_ext/Complex.h>
 #include <R_ext/Constants.h>
+#include <R_ext/Lapack.h>
 
 //static const double pi=3.1415926535;
+// Default number of interpolated points on each side of
+// a transmitter sample in the range ambiguity functions
 #define AMB_N_INTERP  5
-
+// Block length in the single pass data preparation
+#define PREPARE_BLOCK 4096
+// Longest tabulated frequency mixing cycle, block length
+// and number of parallel lanes in the oscillator
+#define MIX_TABLE_MAX 65536
+#define MIX_NCO_BLOCK 4096
+#define MIX_NCO_LANES 8
+// Block length in the multi-lag lagged product calculation
+#define LAGPROD_BLOCK 2048
+// Number of samples in a block of cumulative sums of the
+// range ambiguity function in theory_rows_fishsr
+#define PREFIX_BLOCK 65536
+// Number of theory rows in a rank-k update of fishsr
+#define FISHSR_PANEL 8
+// Number of 64-bit words in a packed index vector of length n
+#define INDEX_BITS_NWORD(n) ( ( (n) + 63 ) / 64 )
+
+// 64 bits of a packed index vector starting from bit k,
+// nw is the number of words in the packed vector
+static inline uint64_t index_bits_word( const uint64_t * bits , const int64_t nw , const int64_t k )
+{
+  const int64_t i = k >> 6;
+  const int s = (int)( k & 63 );
+  uint64_t w = ( i < nw ) ? ( bits[i] >> s ) : 0;
+  if( s && ( i + 1 ) < nw ) w |= bits[i+1] << ( 64 - s );
+  return(w);
+}
+
+// Removed sample ranges of a data vector in the data
+// preparation, see prepare_stream_cuts. Sample k of the
+// remaining data is raw sample k + off[m], where m is the
+// number of ranges with kpos <= k. m is kept as a cursor
+// between the calls.
+typedef struct {
+  const int64_t * kpos;
+  const int64_t * off;
+  int n;
+  int m;
+} prepare_cuts;
+
+// Raw sample index of sample k of the remaining data, k
+// itself if no samples are removed. The cursor is moved
+// one range at a time, nearby samples are cheap to map.
+static inline int64_t prepare_cuts_raw( prepare_cuts * cuts , const int64_t k )
+{
+  if( cuts == NULL ) return(k);
+  while( ( cuts->m < cuts->n ) && ( cuts->kpos[ cuts->m ] <= k ) ) ++cuts->m;
+  while( ( cuts->m > 0 ) && ( cuts->kpos[ cuts->m - 1 ] > k ) ) --cuts->m;
+  return( k + cuts->off[ cuts->m ] );
+}
+
+// Store a complex value either in an R complex vector or,
+// if cf is not NULL, in a single precision vector of
+// interleaved real and imaginary parts
+static inline void complex_store( Rcomplex * c , float * cf , const int64_t k , const double re , const double im )
+{
+  if( cf ){
+    cf[ 2 * k ] = (float)re;
+    cf[ 2 * k + 1 ] = (float)im;
+  }else{
+    c[k].r = re;
+    c[k].i = im;
+  }
+}
+
+// Read a complex value stored by complex_store
+static inline void complex_load( const Rcomplex * c , const float * cf , const int64_t k , double * re , double * im )
+{
+  if( cf ){
+    *re = (double)cf[ 2 * k ];
+    *im = (double)cf[ 2 * k + 1 ];
+  }else{
+    *re = c[k].r;
+    *im = c[k].i;
+  }
+}
+
+// Offset of row i of tile column bj in a tiled Fisher
+// information matrix, element (i,j) of the upper triangle
+// is at tile_offset(i,j/tile,n,tile) + j. The matrix is
+// divided in tile x tile blocks, which are stored
+// contiguously in the row-packed order of the upper
+// triangle of blocks, each block in row-major order.
+static inline int64_t tile_offset( const int64_t i , const int64_t bj , const int n , const int tile )
+{
+  const int64_t nb = ( n + tile - 1 ) / tile;
+  const int64_t bi = i / tile;
+
+  return( ( bi * nb - ( bi * ( bi - 1 ) ) / 2 + bj - bi ) * tile * tile + ( i % tile ) * tile - bj * tile );
+}
+
+// Number of samples from the last pulse sample before
+// sample k to sample k-1, at most r_max, in a pulse list
+// of amb_pulses_add. p is the number of pulses that start
+// before an earlier sample k, it is updated for this k.
+static inline int amb_pulses_since( const int * pulses , int * p , const int64_t k , const int r_max )
+{
+  int64_t last;
+
+  while( ( *p < pulses[0] ) && ( pulses[ 2 * *p + 1 ] < k ) ) ++(*p);
+  if( *p == 0 ) return( r_max );
+  last = pulses[ 2 * *p ] - 1;
+  if( last > ( k - 1 ) ) last = k - 1;
+  return( ( k - 1 - last ) < r_max ? (int)( k - 1 - last ) : r_max );
+}
 
 // gdf file input
 SEXP read_gdf_data_R( SEXP ndata , SEXP nfiles , SEXP filepaths , SEXP istart , SEXP iend , SEXP bigendian);
+SEXP read_gdf_data_int16_R( SEXP ndata , SEXP nfiles , SEXP filepaths , SEXP istart , SEXP iend , SEXP bigendian);
 SEXP read_gdf_data( SEXP cata , SEXP idatar , SEXP idatai , SEXP ndata , SEXP nfiles, SEXP filepaths , SEXP istart , SEXP iend , SEXP bigendian);
 
 // Frequency mixing
 SEXP mix_frequency_R( SEXP cdata , SEXP ndata , SEXP frequency);
 SEXP mix_frequency( SEXP cdata , SEXP ndata , SEXP frequency);
+int mix_frequency_coefs( const double fr , const int nd , double ** coefr , double ** coefi );
+void mix_frequency_nco( const double fr , const int64_t k0 , const int64_t n , double * cr , double * ci );
 
 // Index adjustments
 SEXP index_adjust_R( SEXP idata , SEXP ndata , SEXP shifts );
 SEXP index_adjust( SEXP idata , SEXP ndata , SEXP shifts );
 
+// Bit-packed index vectors
+SEXP index_bits( SEXP idata , SEXP ndata );
+void index_bits_pack( const int * id , const int64_t nd , uint64_t * bits );
+
 // Lagged products
 SEXP lagged_products_alloc( SEXP cdata1 , SEXP cdata2 , SEXP idata1 , SEXP idata2 , SEXP ndata1 , SEXP ndata2 , SEXP lag);
-SEXP lagged_products( SEXP cdata1 , SEXP cdata2 , SEXP idata1 , SEXP idata2 , SEXP cdatap , SEXP idatap , SEXP ndata1 , SEXP ndata2 , SEXP lag );
+SEXP lagged_products( SEXP cdata1 , SEXP cdata2 , SEXP idata1 , SEXP idata2 , SEXP rdata1 , SEXP rdata2 , SEXP cdatap , SEXP idatap , SEXP vardata , SEXP ndata1 , SEXP ndata2 , SEXP lag , SEXP pamb );
+void lagged_products_range( const Rcomplex * cd1 , const Rcomplex * cd2 , const int * id1 , const int * id2 , const uint64_t * b1 , const int64_t nw1 , const uint64_t * b2 , const int64_t nw2 , Rcomplex * cdp , float * cdpf , int * idp , const double * rd1 , const double * rd2 , double * prd , const int k0 , const int k1 , const int l , int * pulses );
+SEXP lagged_products_lags( SEXP cdata1 , SEXP cdata2 , SEXP idata1 , SEXP idata2 , SEXP rdata1 , SEXP rdata2 , SEXP cdatap , SEXP idatap , SEXP vardata , SEXP ndata1 , SEXP ndata2 , SEXP lags , SEXP pamb );
 SEXP lagged_products_r( SEXP rdata1 , SEXP rdata2 , SEXP prdata , SEXP ndata1 , SEXP ndata2 , SEXP lag );
 
 // Theory matrix construction
 SEXP theory_rows_alloc( SEXP camb , SEXP iamb , SEXP cprod , SEXP iprod , SEXP rvar , SEXP ndata , SEXP ncur , SEXP nend , SEXP rlims , SEXP nranges , SEXP fitsize , SEXP background, SEXP remoterx ); 
-SEXP theory_rows( SEXP camb , SEXP iamb , SEXP cprod , SEXP iprod , SEXP rvar , SEXP ndata , SEXP ncur , SEXP nend , SEXP rlims , SEXP nranges , SEXP arows , SEXP irows , SEXP mvec , SEXP mvar , SEXP nrows , SEXP background, SEXP remoterx );
-SEXP theory_rows_r( SEXP camb , SEXP iamb , SEXP cprod , SEXP iprod , SEXP rvar , SEXP ndata , SEXP ncur , SEXP nend , SEXP rlims , SEXP nranges , SEXP arows , SEXP arowsI , SEXP irows , SEXP mvecR , SEXP mvecI , SEXP mvar , SEXP nrows , SEXP background, SEXP remoterx );
+SEXP theory_rows( SEXP camb , SEXP iamb , SEXP pamb , SEXP cprod , SEXP iprod , SEXP rvar , SEXP ndata , SEXP ncur , SEXP nend , SEXP rlims , SEXP nranges , SEXP arows , SEXP irows , SEXP mvec , SEXP mvar , SEXP nrows , SEXP background, SEXP remoterx , SEXP sparse );
+SEXP theory_rows_r( SEXP camb , SEXP iamb , SEXP pamb , SEXP cprod , SEXP iprod , SEXP rvar , SEXP ndata , SEXP ncur , SEXP nend , SEXP rlims , SEXP nranges , SEXP arows , SEXP arowsI , SEXP irows , SEXP mvecR , SEXP mvecI , SEXP mvar , SEXP nrows , SEXP background, SEXP remoterx , SEXP sparse );
+SEXP theory_rows_f( SEXP camb , SEXP iamb , SEXP pamb , SEXP cprod , SEXP iprod , SEXP rvar , SEXP ndata , SEXP ncur , SEXP nend , SEXP rlims , SEXP nranges , SEXP arowsR , SEXP arowsI , SEXP irows , SEXP mvecR , SEXP mvecI , SEXP mvar , SEXP nrows , SEXP background, SEXP remoterx , SEXP sparse );
+SEXP theory_rows_fishsr( SEXP camb , SEXP iamb , SEXP pamb , SEXP cprod , SEXP iprod , SEXP rvar , SEXP ndata , SEXP ncur , SEXP nend , SEXP rlims , SEXP nranges , SEXP background , SEXP remoterx , SEXP QvecR , SEXP QvecI , SEXP yvecR , SEXP yvecI , SEXP flops , SEXP tile , SEXP band );
+SEXP cache_sizes( void );
+int64_t amb_prefix( const Rcomplex * amb , const float * ambf , const int * amb_i , const int * pulses , const int64_t k0 , const int64_t k1 , double * pR , double * pI , int * pc , int * ps , int * cur , const int ncur );
+void amb_prefix_row( const double * pR , const double * pI , const int * pc , const int * ps , const int64_t np , int * cur , const int64_t k , const int * r_lims , const int n_ranges , double * aR , double * aI , const int stride , int * cnt );
+void amb_pulses_add( const int * amb_i , const int64_t k0 , const int64_t k1 , int * pulses );
+int amb_pulses_first( const int * pulses , const int64_t k );
+int64_t amb_pulses_count( const int * pulses , const int64_t k0 , const int64_t k1 );
+int sparse_row_runs( const int * cnt , const int n , int * runs );
+void sparse_rows_whiten( const int * runs , const int nr , const double * var , const float * fR , const float * fI , const float * fmR , const float * fmI , double * aR , double * aI , double * mR , double * mI );
+int64_t sparse_rows_nval( const int * runs , const int nr );
 
 // Inverse problem solvers
-SEXP fishs_add( SEXP Qvec , SEXP yvec , const SEXP arows , const SEXP irows , const SEXP meas , const SEXP var , const SEXP nx , const SEXP nrow );
-SEXP fishsr_add( SEXP QvecR , SEXP QvecI , SEXP yvecR , SEXP yvecI , const SEXP arowsR , const SEXP arowsI , const SEXP irows , const SEXP measR , const SEXP measI , const SEXP var , const SEXP nx , const SEXP nrow , SEXP flops);
-SEXP deco_add( SEXP Qvec , SEXP yvec , const SEXP arows , const SEXP irows , const SEXP meas , const SEXP var , const SEXP nx , const SEXP nrow );
-SEXP decor_add( SEXP QvecR , SEXP yvecR , SEXP yvecI , const SEXP arowsR, const SEXP arowsI , SEXP irows , const SEXP measR , const SEXP measI , const SEXP var , const SEXP nx , const SEXP nrow , SEXP flops );
+SEXP fishs_add( SEXP Qvec , SEXP yvec , const SEXP arows , const SEXP irows , const SEXP meas , const SEXP var , const SEXP nx , const SEXP nrow , const SEXP sparse );
+SEXP fishsr_add( SEXP QvecR , SEXP QvecI , SEXP yvecR , SEXP yvecI , const SEXP arowsR , const SEXP arowsI , const SEXP irows , const SEXP measR , const SEXP measI , const SEXP var , const SEXP nx , const SEXP nrow , SEXP flops , const SEXP sparse , const SEXP tile , const SEXP band );
+int64_t fishsr_add_rows( double * qR , double * qI , double * yR , double * yI , const double * aR , const double * aI , const int * ir , const double * mR , const double * mI , const int n , const int nr , double * wR , double * wI , int * cover , const int tile , const int band );
+void whiten_rows_float( const float * aR , const float * aI , const int * ir , const float * mR , const float * mI , const double * var , const int n , const int nr , double * aRo , double * aIo , double * mRo , double * mIo );
+SEXP deco_add( SEXP Qvec , SEXP yvec , const SEXP arows , const SEXP irows , const SEXP meas , const SEXP var , const SEXP nx , const SEXP nrow , const SEXP sparse );
+SEXP decor_add( SEXP QvecR , SEXP yvecR , SEXP yvecI , const SEXP arowsR, const SEXP arowsI , SEXP irows , const SEXP measR , const SEXP measI , const SEXP var , const SEXP nx , const SEXP nrow , SEXP flops , const SEXP sparse );
+SEXP fishsr_solve( SEXP QvecR , SEXP QvecI , SEXP yvecR , SEXP yvecI , SEXP nx , SEXP tile , SEXP fullcovar );
+SEXP fishsr_band_width( SEXP idata , SEXP ndata , SEXP rlims , SEXP nranges );
+SEXP fishsr_band_solve( SEXP QvecR , SEXP QvecI , SEXP yvecR , SEXP yvecI , SEXP nx , SEXP band , SEXP fullcovar );
+void fishsr_band_inverse( const Rcomplex * ab , const int m , const int kd , Rcomplex * zb );
 SEXP dummy_add( SEXP msum , SEXP vsum , SEXP rmin , SEXP rmax , SEXP mdata , SEXP mambig , SEXP iamb , SEXP iprod , SEXP edata , SEXP ndata );
 
 // All data preparations collected together
-SEXP prepare_data( SEXP cdata , SEXP idata , SEXP ndata , SEXP frequency, SEXP shifts , SEXP nup , SEXP nfilter , SEXP nfirst , SEXP nfirstfrac , SEXP ipartial );
+SEXP prepare_data( SEXP cdata , SEXP idata , SEXP ndata , SEXP frequency, SEXP shifts , SEXP nup , SEXP nfilter , SEXP nfirst , SEXP nfirstfrac , SEXP ipartial , SEXP trimstart , SEXP trimlen );
+SEXP prepare_data_streams( SEXP cdata , SEXP idata , SEXP ndata , SEXP frequency , SEXP shifts , SEXP nup , SEXP nfilter , SEXP nfirst , SEXP nfirstfrac , SEXP ipartial , SEXP taps , SEXP trimstart , SEXP trimlen );
+int64_t prepare_stream( const Rcomplex * cd , const int16_t * cd16 , const int * id , const int64_t nd , prepare_cuts * cuts , const double fr , const int ncycle , const double * coefr , const double * coefi , const int sh0 , const int sh1 , const int nu , const int nf , const int ns , const int nsf , const int ipar , const double * taps , const int ntaps , Rcomplex * co , int * io );
+int64_t prepare_stream_fir( const Rcomplex * cd , const int16_t * cd16 , const int * id , const int64_t nd , prepare_cuts * cuts , const double fr , const int ncycle , const double * coefr , const double * coefi , const int sh0 , const int sh1 , const int nu , const int nf , const int ns , const int nsf , const int ipar , const double * taps , const int ntaps , Rcomplex * co , int * io );
+int prepare_stream_cuts( const int64_t nd , const int * cstart , const int * clen , const int ncuts , int64_t * kpos , int64_t * off , int64_t * nkept );
+int64_t prepare_stream_length( const int64_t nd , const int nu , const int nf , const int ns , const int nsf , const int ntaps );
+void prepare_stream_sample( const Rcomplex * cd , const int16_t * cd16 , const int64_t k , const int mix , const double cr , const double ci , Rcomplex * ctmp );
+void index_adjust_block( const int * id , const int64_t nd , prepare_cuts * cuts , const int sh0 , const int sh1 , const int64_t ncut , const int64_t kb , int * ib , int64_t * nwin , const int first );
+int index_adjust_nonzero( const int * id , const int64_t nd , prepare_cuts * cuts , const int sh0 , const int64_t k , const int outside );
 
 // Average signal power in points withe identical IPPs and pulse lengths
 SEXP average_power( SEXP cdata , SEXP idatatx , SEXP idatarx , SEXP ndata , SEXP maxrange , SEXP nminave);
 
-// Average lag profile
-SEXP average_profile( SEXP cdata , SEXP idata , SEXP ndata , SEXP N_CODE);
+// Average lag profiles and range ambiguity functions over code cycles
+SEXP average_profile( SEXP cprod , SEXP iprod , SEXP vardata , SEXP camb , SEXP iamb , SEXP idata , SEXP ndata , SEXP N_CODE , SEXP pamb );
 
 // Resampling
 SEXP resample( SEXP cdata , SEXP idata , SEXP ndata , SEXP nup , SEXP nfilter , SEXP nfirst , SEXP nfirstfrac , SEXP ipartial);
 SEXP resample_R( SEXP cdata , SEXP idata , SEXP ndata , SEXP nup , SEXP nfilter , SEXP nfirst , SEXP nfirstfrac , SEXP ipartial);
+void resample_fir_tables( const double * taps , const int ntaps , const int nu , const int ntab , double * g , int * gnz );
+int resample_fir_ntab( const int ntaps , const int nu );
+void resample_fir( const double * xr , const double * xi , const int * xid , const int64_t bs , const double * g , const int * gnz , const int ntab , const int nu , const int nf , const int64_t i0 , const int64_t l0 , const int64_t l1 , const int ipar , double * accr , double * acci , int * accp , int * accs , Rcomplex * co , int * io );
 
 // Range ambiguity function calculation with optional interpolation
-SEXP range_ambiguity( SEXP cdata1 ,SEXP cdata2 , SEXP idata1 , SEXP idata2 , SEXP cdatap , SEXP idatap , SEXP ndata1 ,  SEXP ndata2 ,  SEXP lag );
+SEXP range_ambiguity( SEXP cdata1 ,SEXP cdata2 , SEXP idata1 , SEXP idata2 , SEXP cdatap , SEXP idatap , SEXP ndata1 ,  SEXP ndata2 ,  SEXP lag , SEXP ninterp , SEXP pamb );
+void range_ambiguity_weights( const int ninterp , double * w );
+
+// Range ambiguity function cache shared by forked workers
+SEXP amb_cache_init( SEXP cdata1 , SEXP cdata2 , SEXP idata1 , SEXP idata2 , SEXP camb , SEXP iamb , SEXP keypar , SEXP sizemb , SEXP tol );
+SEXP amb_cache_get( SEXP lag , SEXP camb , SEXP iamb , SEXP pamb );
+SEXP amb_cache_put( SEXP lag , SEXP camb , SEXP iamb );
 
 // Ground clutter suppression
 SEXP clutter_meas( const SEXP tcdata , const SEXP tidata , const SEXP rcdata , const SEXP ridata , const SEXP ndata , const SEXP rmin ,  const SEXP rmax , SEXP Qvec , SEXP yvec );
@@ -0,0 +1,395 @@
+// file:amb_cache.c
+// (c) 2010- University of Oulu, Finland
+// Written by Ilkka Virtanen <ilkka.i.virtanen@oulu.fi>
+// Licensed under FreeBSD license.
+
+#include "LPI.h"
+#include <string.h>
+#include <sys/mman.h>
+
+/*
+  Cache of range ambiguity functions.
+
+  The cache lives in a shared anonymous memory mapping,
+  which is created in the process that solves the
+  integration periods. Lag profile workers forked from
+  that process see the same mapping, and the functions
+  stored by one worker are available to all other
+  workers and to the following integration periods.
+
+  The mapping contains a header, copies of the transmitter
+  samples the stored functions were calculated from, a
+  slot table, and one slot per stored lag. A slot contains
+  the range ambiguity function as such and its index
+  vector packed into 64-bit words.
+
+  Only amb_cache_init modifies the header and reference
+  samples, and it is called while no workers are running.
+  Workers claim slots with an atomic counter and mark
+  them ready only after the data have been written.
+*/
+
+typedef struct {
+  int32_t lag;
+  int32_t ready;
+} amb_cache_slot;
+
+typedef struct {
+  uint64_t key;
+  int64_t ntx1;
+  int64_t ntx2;
+  int64_t ncamb;
+  int64_t niamb;
+  int64_t nslot;
+  int64_t nused;
+  int32_t valid;
+} amb_cache_header;
+
+static char * amb_cache_map = NULL;
+static size_t amb_cache_size = 0;
+
+// Bytes rounded up to a multiple of 64
+#define AMB_CACHE_ALIGN(n) ( ( ( n ) + 63 ) & ~( (size_t) 63 ) )
+
+// Parts of the mapping
+static amb_cache_slot * amb_cache_slots( const amb_cache_header * h )
+{
+  return( (amb_cache_slot*)( amb_cache_map + AMB_CACHE_ALIGN( sizeof(amb_cache_header) ) + AMB_CACHE_ALIGN( ( h->ntx1 + h->ntx2 ) * sizeof(Rcomplex) ) ) );
+}
+
+static size_t amb_cache_slotbytes( const amb_cache_header * h )
+{
+  return( AMB_CACHE_ALIGN( h->ncamb ) + AMB_CACHE_ALIGN( INDEX_BITS_NWORD( h->niamb ) * sizeof(uint64_t) ) );
+}
+
+static char * amb_cache_slotdata( const amb_cache_header * h , const int64_t i )
+{
+  return( (char*)amb_cache_slots( h ) + AMB_CACHE_ALIGN( h->nslot * sizeof(amb_cache_slot) ) + i * amb_cache_slotbytes( h ) );
+}
+
+// Bytes in a range ambiguity function vector
+static int64_t amb_cache_nbytes( SEXP camb )
+{
+  if( TYPEOF(camb) == CPLXSXP ) return( (int64_t)LENGTH(camb) * sizeof(Rcomplex) );
+  if( TYPEOF(camb) == REALSXP ) return( (int64_t)LENGTH(camb) * sizeof(double) );
+  if( TYPEOF(camb) == RAWSXP ) return( (int64_t)LENGTH(camb) );
+  return(-1);
+}
+
+// Data pointer of a range ambiguity function vector
+static void * amb_cache_ptr( SEXP camb )
+{
+  if( TYPEOF(camb) == CPLXSXP ) return( (void*)COMPLEX(camb) );
+  if( TYPEOF(camb) == REALSXP ) return( (void*)REAL(camb) );
+  return( (void*)RAW(camb) );
+}
+
+// 64-bit FNV-1a hash
+static uint64_t amb_cache_hash( uint64_t h , const void * x , const size_t n )
+{
+  const unsigned char * c = (const unsigned char *)x;
+  size_t i;
+  for( i = 0 ; i < n ; ++i ){
+    h ^= c[i];
+    h *= 1099511628211ULL;
+  }
+  return(h);
+}
+
+// Hash of a logical index vector, packed 64 points at a time
+static uint64_t amb_cache_hash_index( uint64_t h , const int * id , const int64_t nd )
+{
+  uint64_t w;
+  int64_t k;
+  int64_t i;
+
+  for( k = 0 ; k < nd ; k += 64 ){
+    w = 0;
+    for( i = 0 ; i < 64 && ( k + i ) < nd ; ++i ) w |= (uint64_t)( id[ k + i ] != 0 ) << i;
+    h = amb_cache_hash( h , &w , sizeof(uint64_t) );
+  }
+  return(h);
+}
+
+// Squared norms of the difference of the transmitter samples
+// from the reference samples and of the reference samples
+static void amb_cache_txdiff( const Rcomplex * cd , const Rcomplex * ref , const int64_t n , double * d2 , double * r2 )
+{
+  int64_t k;
+  double dr;
+  double di;
+
+  for( k = 0 ; k < n ; ++k ){
+    dr = cd[k].r - ref[k].r;
+    di = cd[k].i - ref[k].i;
+    *d2 += dr * dr + di * di;
+    *r2 += ref[k].r * ref[k].r + ref[k].i * ref[k].i;
+  }
+}
+
+/*
+  Prepare the range ambiguity function cache for a new
+  integration period.
+
+  The cache is keyed by a hash of the transmitter index
+  vectors, the vector lengths, and the parameters of the
+  ambiguity function calculation. Stored functions are
+  kept if the key matches and the transmitter samples
+  differ from those of the stored functions by at most
+  the relative tolerance tol in the 2-norm. Otherwise the
+  cache is emptied and the current samples become the
+  new reference.
+
+  Arguments:
+   cdata1  First complex transmitter samples
+   cdata2  Second complex transmitter samples
+   idata1  First transmitter sample indices
+   idata2  Second transmitter sample indices
+   camb    Range ambiguity function vector
+   iamb    Range ambiguity index vector
+   keypar  Integer vector of other parameters that
+           affect the range ambiguity functions
+   sizemb  Size of the cache in megabytes, the cache
+           is released if sizemb <= 0
+   tol     Relative tolerance of the transmitter samples
+
+  Returns:
+   success TRUE if the cache can be used for this
+           integration period, FALSE otherwise
+
+*/
+
+SEXP amb_cache_init( SEXP cdata1 , SEXP cdata2 , SEXP idata1 , SEXP idata2 , SEXP camb , SEXP iamb , SEXP keypar , SEXP sizemb , SEXP tol )
+{
+  const int64_t ntx1 = LENGTH(cdata1);
+  const int64_t ntx2 = LENGTH(cdata2);
+  const int64_t ncamb = amb_cache_nbytes( camb );
+  const int64_t niamb = LENGTH(iamb);
+  const size_t size = (size_t)( *REAL(sizemb) * 1048576. );
+  const double t = *REAL(tol);
+  amb_cache_header * h;
+  Rcomplex * ref;
+  uint64_t key = 14695981039346656037ULL;
+  int64_t nlen[4] = { ntx1 , ntx2 , ncamb , niamb };
+  size_t nfix;
+  double d2 = .0;
+  double r2 = .0;
+  SEXP success;
+
+  PROTECT( success = allocVector( LGLSXP , 1 ) );
+  *LOGICAL(success) = 0;
+
+  // Release the old mapping if the size was changed
+  if( ( amb_cache_map != NULL ) & ( size != amb_cache_size ) ){
+    munmap( amb_cache_map , amb_cache_size );
+    amb_cache_map = NULL;
+    amb_cache_size = 0;
+  }
+
+  // Caching is not used
+  if( ( *REAL(sizemb) <= 0 ) | ( ncamb < 0 ) ){
+    UNPROTECT(1);
+    return(success);
+  }
+
+  // A new shared mapping
+  if( amb_cache_map == NULL ){
+    amb_cache_map = (char*) mmap( NULL , size , PROT_READ | PROT_WRITE , MAP_SHARED | MAP_ANONYMOUS , -1 , 0 );
+    if( amb_cache_map == MAP_FAILED ){
+      amb_cache_map = NULL;
+      UNPROTECT(1);
+      return(success);
+    }
+    amb_cache_size = size;
+    ((amb_cache_header*)amb_cache_map)->valid = 0;
+  }
+
+  h = (amb_cache_header*)amb_cache_map;
+  ref = (Rcomplex*)( amb_cache_map + AMB_CACHE_ALIGN( sizeof(amb_cache_header) ) );
+
+  // The cache key
+  key = amb_cache_hash( key , nlen , sizeof(nlen) );
+  key = amb_cache_hash( key , INTEGER(keypar) , LENGTH(keypar) * sizeof(int) );
+  key = amb_cache_hash_index( key , LOGICAL(idata1) , LENGTH(idata1) );
+  key = amb_cache_hash_index( key , LOGICAL(idata2) , LENGTH(idata2) );
+
+  // Keep the stored functions if the key matches and the
+  // transmitter samples are close enough to the reference
+  if( h->valid && ( h->key == key ) ){
+    amb_cache_txdiff( COMPLEX(cdata1) , ref , ntx1 , &d2 , &r2 );
+    amb_cache_txdiff( COMPLEX(cdata2) , ref + ntx1 , ntx2 , &d2 , &r2 );
+    if( d2 <= ( t * t * r2 ) ){
+      *LOGICAL(success) = 1;
+      UNPROTECT(1);
+      return(success);
+    }
+  }
+
+  // Otherwise start from an empty cache
+  h->valid = 0;
+  h->key = key;
+  h->ntx1 = ntx1;
+  h->ntx2 = ntx2;
+  h->ncamb = ncamb;
+  h->niamb = niamb;
+  h->nused = 0;
+  h->nslot = 0;
+
+  // Number of slots that fit in the mapping
+  nfix = AMB_CACHE_ALIGN( sizeof(amb_cache_header) ) + AMB_CACHE_ALIGN( ( ntx1 + ntx2 ) * sizeof(Rcomplex) );
+  if( size > nfix ){
+    h->nslot = ( size - nfix ) / ( amb_cache_slotbytes( h ) + sizeof(amb_cache_slot) );
+    while( ( h->nslot > 0 ) && ( ( nfix + AMB_CACHE_ALIGN( h->nslot * sizeof(amb_cache_slot) ) + h->nslot * amb_cache_slotbytes( h ) ) > size ) ) --(h->nslot);
+  }
+  if( h->nslot < 1 ){
+    UNPROTECT(1);
+    return(success);
+  }
+
+  // The reference samples and an empty slot table
+  memcpy( ref , COMPLEX(cdata1) , ntx1 * sizeof(Rcomplex) );
+  memcpy( ref + ntx1 , COMPLEX(cdata2) , ntx2 * sizeof(Rcomplex) );
+  memset( amb_cache_slots( h ) , 0 , h->nslot * sizeof(amb_cache_slot) );
+
+  h->valid = 1;
+  *LOGICAL(success) = 1;
+
+  UNPROTECT(1);
+
+  return(success);
+
+}
+
+// The cache header if camb and iamb match the stored functions, NULL otherwise
+static amb_cache_header * amb_cache_check( SEXP camb , SEXP iamb )
+{
+  amb_cache_header * h = (amb_cache_header*)amb_cache_map;
+
+  if( h == NULL ) return(NULL);
+  if( !h->valid ) return(NULL);
+  if( ( h->ncamb != amb_cache_nbytes( camb ) ) | ( h->niamb != LENGTH(iamb) ) ) return(NULL);
+  return(h);
+}
+
+/*
+  Copy a stored range ambiguity function from the cache.
+  The pulse list of the function is formed while the
+  index vector is unpacked.
+
+  Arguments:
+   lag     Lag
+   camb    Range ambiguity function vector
+   iamb    Range ambiguity index vector
+   pamb    Integer vector for the pulse list of
+           amb_pulses_add, at least length(iamb) + 2 values
+
+  Returns:
+   success TRUE if the function was found and copied
+           to camb and iamb, FALSE otherwise
+
+*/
+
+SEXP amb_cache_get( SEXP lag , SEXP camb , SEXP iamb , SEXP pamb )
+{
+  amb_cache_header * h = amb_cache_check( camb , iamb );
+  amb_cache_slot * s;
+  const uint64_t * bits;
+  int * id;
+  int * pl;
+  int64_t nused;
+  int64_t i;
+  int64_t k;
+  int64_t n;
+  int64_t j;
+  int l = *INTEGER(lag);
+  SEXP success;
+
+  PROTECT( success = allocVector( LGLSXP , 1 ) );
+  *LOGICAL(success) = 0;
+
+  if( h != NULL ){
+    s = amb_cache_slots( h );
+    nused = __atomic_load_n( &(h->nused) , __ATOMIC_ACQUIRE );
+    if( nused > h->nslot ) nused = h->nslot;
+    for( i = 0 ; i < nused ; ++i ){
+      if( __atomic_load_n( &(s[i].ready) , __ATOMIC_ACQUIRE ) && ( s[i].lag == l ) ){
+        memcpy( amb_cache_ptr( camb ) , amb_cache_slotdata( h , i ) , h->ncamb );
+        bits = (const uint64_t*)( amb_cache_slotdata( h , i ) + AMB_CACHE_ALIGN( h->ncamb ) );
+        id = LOGICAL(iamb);
+        pl = INTEGER(pamb);
+        pl[0] = 0;
+        for( k = 0 ; k < h->niamb ; k += 64 ){
+          n = ( h->niamb - k ) < 64 ? ( h->niamb - k ) : 64;
+          for( j = 0 ; j < n ; ++j ) id[ k + j ] = (int)( ( bits[ k >> 6 ] >> j ) & 1 );
+          if( bits[ k >> 6 ] ) amb_pulses_add( id , k , k + n , pl );
+        }
+        *LOGICAL(success) = 1;
+        break;
+      }
+    }
+  }
+
+  UNPROTECT(1);
+
+  return(success);
+
+}
+
+/*
+  Store a range ambiguity function in the cache.
+
+  Arguments:
+   lag     Lag
+   camb    Range ambiguity function vector
+   iamb    Range ambiguity index vector
+
+  Returns:
+   success TRUE if the function was stored or was already
+           in the cache, FALSE if the cache is full or
+           not in use
+
+*/
+
+SEXP amb_cache_put( SEXP lag , SEXP camb , SEXP iamb )
+{
+  amb_cache_header * h = amb_cache_check( camb , iamb );
+  amb_cache_slot * s;
+  int64_t nused;
+  int64_t i;
+  int l = *INTEGER(lag);
+  SEXP success;
+
+  PROTECT( success = allocVector( LGLSXP , 1 ) );
+  *LOGICAL(success) = 0;
+
+  if( h != NULL ){
+    s = amb_cache_slots( h );
+
+    // Is the lag already stored?
+    nused = __atomic_load_n( &(h->nused) , __ATOMIC_ACQUIRE );
+    if( nused > h->nslot ) nused = h->nslot;
+    for( i = 0 ; i < nused ; ++i ){
+      if( __atomic_load_n( &(s[i].ready) , __ATOMIC_ACQUIRE ) && ( s[i].lag == l ) ){
+        *LOGICAL(success) = 1;
+        break;
+      }
+    }
+
+    // Claim a new slot, write the data, and mark it ready
+    if( !*LOGICAL(success) ){
+      i = __atomic_fetch_add( &(h->nused) , 1 , __ATOMIC_ACQ_REL );
+      if( i < h->nslot ){
+        s[i].lag = l;
+        memcpy( amb_cache_slotdata( h , i ) , amb_cache_ptr( camb ) , h->ncamb );
+        index_bits_pack( LOGICAL(iamb) , h->niamb , (uint64_t*)( amb_cache_slotdata( h , i ) + AMB_CACHE_ALIGN( h->ncamb ) ) );
+        __atomic_store_n( &(s[i].ready) , 1 , __ATOMIC_RELEASE );
+        *LOGICAL(success) = 1;
+      }
+    }
+  }
+
+  UNPROTECT(1);
+
+  return(success);
+
+}
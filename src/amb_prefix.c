@@ -0,0 +1,146 @@
+// file:amb_prefix.c
+// (c) 2010- University of Oulu, Finland
+// Written by Ilkka Virtanen <ilkka.i.virtanen@oulu.fi>
+// Licensed under FreeBSD license.
+
+#include "LPI.h"
+
+/*
+  Cumulative sums of a range ambiguity function.
+
+  A range gate of a theory row is a sum of the range
+  ambiguity function over the samples between two gate
+  limits, which is a difference of two cumulative sums.
+  Only the samples in the pulse list of the function are
+  visited, the sums are stored for each pulse sample, and
+  the index vector is summed separately.
+
+  Arguments:
+   amb     Complex range ambiguity function, or NULL
+   ambf    Single precision range ambiguity function with
+           interleaved real and imaginary parts, used if
+           amb is NULL
+   amb_i   Index vector of the range ambiguity function
+   pulses  Pulse list of the function from amb_pulses_add
+   k0      First sample of the sums
+   k1      Last sample of the sums + 1
+   pR      Output vector of at most k1 - k0 + 1 values,
+           pR[t] is the sum of real parts of the first t
+           pulse samples from k0 on
+   pI      Output vector for the imaginary parts
+   pc      Output vector for the index sums
+   ps      Output vector of at most k1 - k0 values, the
+           pulse samples of the sums
+   cur     Gate limit positions of amb_prefix_row, reset
+           for the new sums
+   ncur    Number of gate limits in cur
+
+  Returns:
+   np      Number of pulse samples from k0 to k1 - 1
+
+*/
+
+int64_t amb_prefix( const Rcomplex * amb , const float * ambf , const int * amb_i , const int * pulses , const int64_t k0 , const int64_t k1 , double * pR , double * pI , int * pc , int * ps , int * cur , const int ncur )
+{
+  int64_t np = 0;
+  int64_t k;
+  int64_t ke;
+  int p;
+  double ar;
+  double ai;
+
+  pR[0] = 0.0;
+  pI[0] = 0.0;
+  pc[0] = 0;
+
+  for( p = amb_pulses_first( pulses , k0 ) ; ( p < pulses[0] ) && ( pulses[ 2 * p + 1 ] < k1 ) ; ++p ){
+    k = ( pulses[ 2 * p + 1 ] > k0 ? pulses[ 2 * p + 1 ] : k0 );
+    ke = ( pulses[ 2 * p + 2 ] < k1 ? pulses[ 2 * p + 2 ] : k1 );
+    for( ; k < ke ; ++k ){
+      complex_load( amb , ambf , k , &ar , &ai );
+      ps[np] = (int)k;
+      pR[ np + 1 ] = pR[np] + ar;
+      pI[ np + 1 ] = pI[np] + ai;
+      pc[ np + 1 ] = pc[np] + amb_i[k];
+      ++np;
+    }
+  }
+
+  for( p = 0 ; p < ncur ; ++p ) cur[p] = -1;
+
+  return(np);
+}
+
+/*
+  Theory row of sample k from the cumulative sums of
+  amb_prefix. Gate i contains the samples from
+  k - r_lims[i+1] + 1 to k - r_lims[i]. The row is set
+  exactly to zero at gates where the index sum is zero.
+  The background gate is not written.
+
+  The position of each gate limit in the pulse samples is
+  kept in cur. The positions are searched for the first
+  row after amb_prefix, and then moved forward, so the
+  rows of one set of sums must be formed in increasing
+  sample order.
+
+  Arguments:
+   pR        Cumulative sums from amb_prefix, real part
+   pI        Imaginary part
+   pc        Index sums
+   ps        Pulse samples of the sums
+   np        Number of pulse samples
+   cur       Positions of the n_ranges + 1 gate limits
+   k         Sample of the theory row
+   r_lims    Range gate limits
+   n_ranges  Number of range gates
+   aR        Output theory row, real part
+   aI        Output theory row, imaginary part
+   stride    Distance of successive gates in aR and aI
+   cnt       Output index vector of the row
+
+*/
+
+void amb_prefix_row( const double * pR , const double * pI , const int * pc , const int * ps , const int64_t np , int * cur , const int64_t k , const int * r_lims , const int n_ranges , double * aR , double * aI , const int stride , int * cnt )
+{
+  int64_t x;
+  int64_t lo;
+  int64_t hi;
+  int64_t m;
+  int a;
+  int b;
+  int i;
+
+  // Number of pulse samples before each gate limit
+  for( i = 0 ; i <= n_ranges ; ++i ){
+    x = k + 1 - r_lims[i];
+    if( cur[i] < 0 ){
+      lo = 0;
+      hi = np;
+      while( lo < hi ){
+        m = ( lo + hi ) / 2;
+        if( ps[m] < x ){
+          lo = m + 1;
+        }else{
+          hi = m;
+        }
+      }
+      cur[i] = (int)lo;
+    }else{
+      while( ( cur[i] < np ) && ( ps[ cur[i] ] < x ) ) ++cur[i];
+    }
+  }
+
+  for( i = 0 ; i < n_ranges ; ++i ){
+    a = cur[ i + 1 ];
+    b = cur[i];
+    cnt[i] = pc[b] - pc[a];
+    if( cnt[i] ){
+      aR[ i * stride ] = pR[b] - pR[a];
+      aI[ i * stride ] = pI[b] - pI[a];
+    }else{
+      aR[ i * stride ] = 0.0;
+      aI[ i * stride ] = 0.0;
+    }
+  }
+}
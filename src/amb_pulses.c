@@ -0,0 +1,112 @@
+// file:amb_pulses.c
+// (c) 2010- University of Oulu, Finland
+// Written by Ilkka Virtanen <ilkka.i.virtanen@oulu.fi>
+// Licensed under FreeBSD license.
+
+#include "LPI.h"
+
+/*
+  Pulse list of a range ambiguity function.
+
+  The range ambiguity function is non-zero only inside the
+  transmitted pulses. The pulse list is an integer vector
+  that contains the number of pulses, followed by the first
+  sample and the last sample + 1 of each pulse. The values
+  of a pulse are the range ambiguity function and index
+  values at these samples. The list of a function of n
+  samples needs at most n + 2 elements.
+
+  The functions that calculate range ambiguity functions
+  append the pulses of each block of samples to the list
+  as soon as the block is ready. The first element of the
+  list must be set to zero before the first block, and the
+  blocks must be added in increasing sample order. A pulse
+  that continues from the previous block is extended.
+
+  Arguments:
+   amb_i   Range ambiguity index vector
+   k0      First sample of the block
+   k1      Last sample of the block + 1
+   pulses  The pulse list
+
+*/
+
+void amb_pulses_add( const int * amb_i , const int64_t k0 , const int64_t k1 , int * pulses )
+{
+  int np = pulses[0];
+  int64_t k;
+
+  for( k = k0 ; k < k1 ; ++k ){
+    if( amb_i[k] ){
+      // A new pulse unless the previous one
+      // ends at this sample
+      if( ( np == 0 ) || ( pulses[ 2 * np ] != k ) ){
+        ++np;
+        pulses[ 2 * np - 1 ] = (int)k;
+      }
+      pulses[ 2 * np ] = (int)( k + 1 );
+    }
+  }
+
+  pulses[0] = np;
+}
+
+/*
+  The first pulse that ends after sample k.
+
+  Arguments:
+   pulses  Pulse list from amb_pulses_add
+   k       Sample index
+
+  Returns:
+   p       Index of the pulse, the number of pulses
+           if all pulses end at or before k
+
+*/
+
+int amb_pulses_first( const int * pulses , const int64_t k )
+{
+  int lo = 0;
+  int hi = pulses[0];
+  int p;
+
+  while( lo < hi ){
+    p = ( lo + hi ) / 2;
+    if( pulses[ 2 * p + 2 ] > k ){
+      hi = p;
+    }else{
+      lo = p + 1;
+    }
+  }
+
+  return(lo);
+}
+
+/*
+  Number of pulse samples from sample k0 to sample k1 - 1.
+
+  Arguments:
+   pulses  Pulse list from amb_pulses_add
+   k0      First sample
+   k1      Last sample + 1
+
+  Returns:
+   n       Number of samples that belong to a pulse
+
+*/
+
+int64_t amb_pulses_count( const int * pulses , const int64_t k0 , const int64_t k1 )
+{
+  int64_t n = 0;
+  int64_t a;
+  int64_t b;
+  int p;
+
+  for( p = amb_pulses_first( pulses , k0 ) ; ( p < pulses[0] ) && ( pulses[ 2 * p + 1 ] < k1 ) ; ++p ){
+    a = ( pulses[ 2 * p + 1 ] > k0 ? pulses[ 2 * p + 1 ] : k0 );
+    b = ( pulses[ 2 * p + 2 ] < k1 ? pulses[ 2 * p + 2 ] : k1 );
+    n += b - a;
+  }
+
+  return(n);
+}
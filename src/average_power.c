@@ -5,6 +5,39 @@
 
 #include "LPI.h"
 
+/*
+  Are the n index values ending at samples a and b identical?
+  Either the logical vector id or the packed vector bits with
+  nw words is used.
+*/
+static int average_power_same( const int * id , const uint64_t * bits , const int64_t nw , const int a , const int b , const int n )
+{
+  int j;
+  int m;
+  uint64_t wa;
+  uint64_t wb;
+
+  if( bits ){
+    // 64 samples at a time
+    for( j = 0 ; j < n ; j += 64 ){
+      m = ( n - j ) < 64 ? ( n - j ) : 64;
+      wa = index_bits_word( bits , nw , a - n + 1 + j );
+      wb = index_bits_word( bits , nw , b - n + 1 + j );
+      if( m < 64 ){
+        wa &= ( (uint64_t)1 << m ) - 1;
+        wb &= ( (uint64_t)1 << m ) - 1;
+      }
+      if( wa != wb ) return(0);
+    }
+  }else{
+    for( j = 0 ; j < n ; ++j ){
+      if( id[ a - j ] != id[ b - j ] ) return(0);
+    }
+  }
+
+  return(1);
+}
+
 /*
   Average power vector for variance estsimation
 
@@ -30,8 +63,10 @@
 
   Arguments:
    cdata    Complex receiver samples
-   idatatx  Transmitter sample index vector
-   idatarx  Receiver sample index vector
+   idatatx  Transmitter sample index vector, logical or
+            bit-packed with index_bits
+   idatarx  Receiver sample index vector, logical or
+            bit-packed with index_bits
    ndata    Number of points in data vectors
    maxrange Maximum range for power profile estimation 
    nminave  Minimum number of samples to be averaged
@@ -45,8 +80,13 @@
 SEXP average_power( SEXP cdata , SEXP idatatx , SEXP idatarx , SEXP ndata , SEXP maxrange , SEXP nminave )
 {
   Rcomplex * cd = COMPLEX( cdata );
-  int * idtx = LOGICAL( idatatx );
-  int * idrx = LOGICAL( idatarx );
+  int * idtx = NULL;
+  int * idrx = NULL;
+  const uint64_t * btx = NULL;
+  const uint64_t * brx = NULL;
+  int64_t nwtx = 0;
+  int64_t nwrx = 0;
+  uint64_t w = 0;
   int nd = *INTEGER( ndata );
   int maxr = *INTEGER( maxrange );
   int nmin = *INTEGER( nminave );
@@ -71,9 +111,22 @@ SEXP average_power( SEXP cdata , SEXP idatatx , SEXP idatarx , SEXP ndata , SEXP
   ntot = 0;
   ptot = .0;
 
-  // Inspect the TX index vector
-  // to make sure that 1 is exactly 1
-  for( k = 0 ; k < nd ; ++k ) idtx[ k ] = idtx[ k ] ? 1 : 0 ;
+  // Bit-packed or logical index vectors
+  if( TYPEOF(idatatx) == RAWSXP ){
+    btx = (uint64_t*)RAW(idatatx);
+    nwtx = LENGTH(idatatx) / sizeof(uint64_t);
+  }else{
+    idtx = LOGICAL(idatatx);
+    // Inspect the TX index vector
+    // to make sure that 1 is exactly 1
+    for( k = 0 ; k < nd ; ++k ) idtx[ k ] = idtx[ k ] ? 1 : 0 ;
+  }
+  if( TYPEOF(idatarx) == RAWSXP ){
+    brx = (uint64_t*)RAW(idatarx);
+    nwrx = LENGTH(idatarx) / sizeof(uint64_t);
+  }else{
+    idrx = LOGICAL(idatarx);
+  }
 
   // Allocate the power vector
   PROTECT( pdata = allocVector( REALSXP , nd ) );
@@ -113,6 +166,17 @@ SEXP average_power( SEXP cdata , SEXP idatatx , SEXP idatarx , SEXP ndata , SEXP
 
   // Locate all falling edges of pulses
   nedges = 0;
+  if( btx ){
+    // Falling edges of 64 samples at a time,
+    // words without edges are skipped
+    for( k = 0 ; k < ( nd - 1 ) ; k += 64 ){
+      w = index_bits_word( btx , nwtx , k ) & ~index_bits_word( btx , nwtx , k + 1 );
+      if( ( nd - 1 - k ) < 64 ) w &= ( (uint64_t)1 << ( nd - 1 - k ) ) - 1;
+      for( i = 0 ; w ; ++i , w >>= 1 ){
+        if( w & 1 ) pedges[ nedges++ ] = k + i;
+      }
+    }
+  }else{
   for( k = 0 ; k < ( nd - 1 ) ; ++k )
     {
       if( idtx[ k ] )
@@ -123,6 +187,7 @@ SEXP average_power( SEXP cdata , SEXP idatatx , SEXP idatarx , SEXP ndata , SEXP
 	    }
 	}
     }
+  }
 
   // The first falling pulse edge at least
   // maxr samples from the beginning
@@ -152,15 +217,7 @@ SEXP average_power( SEXP cdata , SEXP idatatx , SEXP idatarx , SEXP ndata , SEXP
 	      if( pinds[ i ] < 0 )
 		{
 		  // Inspect the points just before this pulse
-		  sameamb = 1;
-		  for( j = 0 ; j < maxr ; ++j )
-		    {
-		      if( (idtx[ pedges[ k ] - j ]) != (idtx[ pedges[ i ] - j ]) )
-			{
-			  sameamb = 0;
-			  break;
-			}
-		    }
+		  sameamb = average_power_same( idtx , btx , nwtx , pedges[ k ] , pedges[ i ] , maxr );
 		  // If the ambiguities were identical,
 		  // assign the pulse with the index pindcur
 		  if( sameamb ) pinds[ i ] = pindcur;
@@ -178,15 +235,7 @@ SEXP average_power( SEXP cdata , SEXP idatatx , SEXP idatarx , SEXP ndata , SEXP
     {
       for( i = p1 ; i < nedges ; ++i )
 	{
-	  sameamb = 1;
-	  for( j = 0 ; j < pedges[ p1 - 1 ] ; ++j )
-	    {
-	      if( idtx[ pedges[ p1 - 1 ] - j ] != idtx[ pedges[ i ] - j ] )
-		{
-		  sameamb = 0;
-		  break;
-		}
-	    }
+	  sameamb = average_power_same( idtx , btx , nwtx , pedges[ p1 - 1 ] , pedges[ i ] , pedges[ p1 - 1 ] );
 	  if( sameamb )
 	    {
 	      pinds[ p1 - 1 ] = pinds[ i ];
@@ -254,11 +303,22 @@ SEXP average_power( SEXP cdata , SEXP idatatx , SEXP idatarx , SEXP ndata , SEXP
 		  for( i = 0 ; i < ippend ; ++i )
 		    {
 		      r = pedges[ j ] + i;
+		      // 64 packed receiver indices at a time,
+		      // words without usable samples are skipped
+		      if( brx && ( ( i & 63 ) == 0 ) )
+			{
+			  w = index_bits_word( brx , nwrx , r );
+			  if( w == 0 )
+			    {
+			      i += 63;
+			      continue;
+			    }
+			}
 		      // This cuts off points that are too close to 
 		      // the beginning of the data vector
 		      if( r >= maxr )
 			{
-			  if( idrx[ r ] )
+			  if( brx ? ( ( w >> ( i & 63 ) ) & 1 ) : idrx[ r ] )
 			    {
 			      ptmp[ i ]  += cd[ r ].r * cd[ r ].r + cd[ r ].i * cd[ r ].i;
 			      nsamp[ i ] += 1;
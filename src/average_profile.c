@@ -6,82 +6,129 @@
 #include "LPI.h"
 
 /*
-  Average lag-profile vector for speeding up
-  the inversion process. Each average is 
-  calculated over samples from  the same point in 
+  Add sample i2 to the average at sample i1. In the first
+  code cycle i1 == i2, and the sample initializes the sum.
+  The index vectors are used as sample counters.
+*/
+
+static void average_profile_add( Rcomplex * cp , int * ip , double * vp , Rcomplex * ca , int * ia , const R_len_t i1 , const R_len_t i2 )
+{
+  if( i1 == i2 ){
+    if( ip[i1] ){
+      ip[i1] = 1;
+    }else{
+      cp[i1].r = 0.;
+      cp[i1].i = 0.;
+      vp[i1] = 0.;
+    }
+    if( ia[i1] ){
+      ia[i1] = 1;
+    }else{
+      ca[i1].r = 0.;
+      ca[i1].i = 0.;
+    }
+  }else{
+    if( ip[i2] ){
+      cp[i1].r += cp[i2].r;
+      cp[i1].i += cp[i2].i;
+      vp[i1] += vp[i2];
+      ++ip[i1];
+    }
+    if( ia[i2] ){
+      ca[i1].r += ca[i2].r;
+      ca[i1].i += ca[i2].i;
+      ++ia[i1];
+    }
+  }
+}
+
+/*
+  Average lag-profile vectors for speeding up
+  the inversion process. Each average is
+  calculated over samples from  the same point in
   the repeated code cycle
 
   The complicated structure is used because
-  measuremnts may contain additional sync 
+  measuremnts may contain additional sync
   times which need to be skipped.
 
+  The lagged products and range ambiguity functions are
+  averaged together in a single pass over the data. Only
+  samples with non-zero index are averaged, and the variance
+  of each averaged product is calculated from the variances
+  of the averaged samples. The averages are written over the
+  first code cycle, and the index vectors are set to 1 at
+  the averaged points. Values after the first code cycle
+  are not meaningful after the call. The pulse list of the
+  averaged range ambiguity function is formed over the
+  first code cycle.
+
+  The first code cycle starts at the first rising edge of
+  idata, a pulse that is already on at the first sample is
+  not averaged. The cycle thus ends at the N_CODE+1'th
+  rising edge, as in which(diff(idata)==1)[N_CODE+1].
+  Samples before the first rising edge are left as they
+  are.
 
   Arguments:
-   cdata  Complex lagged product vector
-   idata  Index vector for cdata
+   cprod  Complex lagged product vector
+   iprod  Index vector of cprod
+   var    Variances of cprod
+   camb   Complex range ambiguity function
+   iamb   Index vector of camb
+   idata  Transmitter index vector
    ndata  Data vector length
    N_CODE Code cycle length
+   pamb   Integer vector for the pulse list of
+          amb_pulses_add, at least ndata + 2 values
 
   Returns:
-   success 1 if the processing was successful, 0 otherwise
- 
+   nend   Length of the first code cycle, counted from
+          the beginning of the data vector, or NA if the
+          data contains less than N_CODE+1 rising edges
+
 */
 
-SEXP average_profile( SEXP cdata , SEXP idata , SEXP ndata , SEXP N_CODE)
+SEXP average_profile( SEXP cprod , SEXP iprod , SEXP vardata , SEXP camb , SEXP iamb , SEXP idata , SEXP ndata , SEXP N_CODE , SEXP pamb )
 {
-  Rcomplex * cd = COMPLEX( cdata );
+  Rcomplex * cp = COMPLEX( cprod );
+  int * ip = LOGICAL( iprod );
+  double * vp = REAL( vardata );
+  Rcomplex * ca = COMPLEX( camb );
+  int * ia = LOGICAL( iamb );
   int * id = LOGICAL( idata );
+  int * pl = INTEGER( pamb );
   int nd = *INTEGER( ndata );
   int ncode = *INTEGER( N_CODE );
-
-  double *aver;
-  double *avei;
-  R_len_t *nave;
   R_len_t k;
   R_len_t ind1 , ind2, ipp_count;
-  SEXP success;
-  int *isuccess;
-
-  // Allocate the return value and initialise it
-  PROTECT(success = allocVector(LGLSXP,1));
-  isuccess = LOGICAL(success);
-  *isuccess = 1;
-
-  // Allocate the average vectors,
-  // real and imaginary parts separately
-  aver = (double*) R_Calloc( nd , double );
-  avei = (double*) R_Calloc( nd , double );
-
-  // Initialise to zero
-  for( k = 0 ; k < nd ; ++k ){
-    aver[ k ] = 0.;
-    avei[ k ] = 0.;
-  }
-
-  // Allocate vector for data sample counter
-  nave = R_Calloc( nd , R_len_t );
+  R_len_t first;
+  R_len_t nend;
+  SEXP ans;
 
-  // Initialise to zero
-  for( k = 0 ; k < nd ; ++k ) nave[ k ] = 0;
+  // Allocate the return value
+  PROTECT( ans = allocVector( INTSXP , 1 ) );
+  *INTEGER(ans) = NA_INTEGER;
 
-  // Start from begniing of the data vctor
+  // Search for the first rising edge, skipping a pulse
+  // that is already on at the first sample
   ind1 = 0;
-  ind2 = 0;
-
-  // Search for the start of the first pulse
-  while( ( id[ind1] == 0 ) & ( ind1 < nd ) ) ++ind1;
-  while( ( id[ind2] == 0 ) & ( ind2 < nd ) ) ++ind2;
+  while( ( ind1 < nd ) && ( id[ind1] != 0 ) ) ++ind1;
+  while( ( ind1 < nd ) && ( id[ind1] == 0 ) ) ++ind1;
+  ind2 = ind1;
+  first = ind1;
+  nend = nd;
   ipp_count = 0;
 
   // Repeat until end of data
   while( ind2 < nd ){
 
     // At this point we should be at pulse starts, loop until
-    // we hit a point at which both pulses have ended.
+    // we hit a point at which both pulses have ended. The
+    // sums end at nend, samples after it are still to be
+    // read through ind2.
     while( id[ind1] | id[ind2]){
-      aver[ind1] += cd[ind2].r;
-      avei[ind1] += cd[ind2].i;
-      ++nave[ind1];
+      if( ind1 < nend ) average_profile_add( cp , ip , vp , ca , ia , ind1 , ind2 );
       ++ind1;
       ++ind2;
       if(ind2==nd) break;
@@ -92,9 +139,7 @@ SEXP average_profile( SEXP cdata , SEXP idata , SEXP ndata , SEXP N_CODE)
     // Add power values until either of the indices
     // hits the next pulse
     while( (id[ind1]==0) & (id[ind2]==0)){
-      aver[ind1] += cd[ind2].r; 
-      avei[ind1] += cd[ind2].i;
-      ++nave[ind1];
+      if( ind1 < nend ) average_profile_add( cp , ip , vp , ca , ia , ind1 , ind2 );
       ++ind1;
       ++ind2;
       if(ind2==nd) break;
@@ -103,90 +148,50 @@ SEXP average_profile( SEXP cdata , SEXP idata , SEXP ndata , SEXP N_CODE)
     if(ind2==nd) break;
 
     // Make sure that both indices point to a pulse start,
-    // increment if necessary (This takes possible sync 
+    // increment if necessary (This takes possible sync
     // times into account)
-    while( ( id[ind1] == 0 ) & ( ind1 < nd ) ) ++ind1;
-    while( ( id[ind2] == 0 ) & ( ind2 < nd ) ) ++ind2;
+    while( ( ind1 < nd ) && ( id[ind1] == 0 ) ) ++ind1;
+    while( ( ind2 < nd ) && ( id[ind2] == 0 ) ) ++ind2;
 
     if(ind2==nd) break;
 
-    // Increment the ipp counter
+    // Increment the ipp counter, the first code cycle
+    // ends at the first restart. Restart also if ind1
+    // has walked past the end of the first cycle.
     ++ipp_count;
-    if( ipp_count == ncode ){
+    if( ( ipp_count == ncode ) | ( ind1 >= nend ) ){
+      if( nend == nd ){
+        nend = ind2;
+        *INTEGER(ans) = (int)ind2;
+      }
       ipp_count = 0;
-      ind1 = 0;
-      while( id[ind1] == 0 ) ++ind1;
+      ind1 = first;
     }
   }
 
-  // Divide the summed values with number of summed pulses
-  for( k = 0 ; k < nd ; ++k ){
-    if( nave[ k ] ){
-      aver[k] /= (double)nave[k];
-      avei[k] /= (double)nave[k];
-    }
-  }
-
-
-  // Now there are averaged values available for one code
-  // cycle, copy the valeus to make furhter analysis
-  // simpler. Start from beginning of the data vector.
-  ind1 = 0;
-  ind2 = 0;
-
-  // Search for the start of the first pulse
-  while( ( id[ind1] == 0 ) & ( ind1 < nd ) ) ++ind1;
-  while( ( id[ind2] == 0 ) & ( ind2 < nd ) ) ++ind2;
-  ipp_count = 0;
-
-  // Repeat until end of data
-  while( ind2 < nd ){
-    // At this point we should be at pulse starts,
-    // loop until both pulses have ended
-    while( id[ind1] | id[ind2]){
-      cd[ind2].r = aver[ind1];
-      cd[ind2].i = avei[ind1];
-      ++ind1;
-      ++ind2;
-      if(ind2==nd) break;
+  // Divide the sums with the numbers of averaged
+  // samples, the variance of an average of n
+  // samples is the sum of variances divided by n^2
+  for( k = first ; k < nend ; ++k ){
+    if( ip[k] ){
+      cp[k].r /= (double)ip[k];
+      cp[k].i /= (double)ip[k];
+      vp[k] /= ( (double)ip[k] * (double)ip[k] );
+      ip[k] = 1;
     }
-
-    if(ind2==nd) break;
-
-    // Add power values until either of
-    // the indices hits the next pulse
-    while( (id[ind1]==0) & (id[ind2]==0)){
-      cd[ind2].r = aver[ind1];
-      cd[ind2].i = avei[ind1];
-      ++ind1;
-      ++ind2;
-      if(ind2==nd) break;
-    }
-
-    if(ind2==nd) break;
-
-    // Make sure that both indices point to a pulse start
-    while( ( id[ind1] == 0 ) & ( ind1 < nd ) ) ++ind1;
-    while( ( id[ind2] == 0 ) & ( ind2 < nd ) ) ++ind2;
-
-    if(ind2==nd) break;
-
-    // Increment the ipp counter
-    ++ipp_count;
-    if( ipp_count == ncode ){
-      ipp_count = 0;
-      ind1 = 0;
-      while( id[ind1] == 0 ) ++ind1;
+    if( ia[k] ){
+      ca[k].r /= (double)ia[k];
+      ca[k].i /= (double)ia[k];
+      ia[k] = 1;
     }
   }
 
-  // Free the temporary vectors
-  Free(nave);
-  Free(aver);
-  Free(avei);
+  // Pulse list of the averaged range ambiguity function
+  pl[0] = 0;
+  amb_pulses_add( ia , 0 , nend , pl );
 
   UNPROTECT(1);
 
-  return( success );
+  return( ans );
 
 }
@@ -0,0 +1,53 @@
+// file:cache_sizes.c
+// (c) 2010- University of Oulu, Finland
+// Written by Ilkka Virtanen <ilkka.i.virtanen@oulu.fi>
+// Licensed under FreeBSD license.
+
+#include <unistd.h>
+#include "LPI.h"
+
+/*
+  Cache sizes and number of processor cores of the
+  current machine, used for sizing the theory row
+  buffers.
+
+  Arguments:
+   none
+
+  Returns:
+   sizes  A vector of L2 cache size, L3 cache size (both
+          in bytes) and the number of online processor
+          cores. Values that cannot be detected are zero.
+
+*/
+
+SEXP cache_sizes( void )
+{
+  SEXP sizes;
+  double * s;
+  long v;
+
+  PROTECT( sizes = allocVector( REALSXP , 3 ) );
+  s = REAL( sizes );
+  s[0] = s[1] = s[2] = 0.;
+
+#ifdef _SC_LEVEL2_CACHE_SIZE
+  v = sysconf( _SC_LEVEL2_CACHE_SIZE );
+  if( v > 0 ) s[0] = (double)v;
+#endif
+
+#ifdef _SC_LEVEL3_CACHE_SIZE
+  v = sysconf( _SC_LEVEL3_CACHE_SIZE );
+  if( v > 0 ) s[1] = (double)v;
+#endif
+
+#ifdef _SC_NPROCESSORS_ONLN
+  v = sysconf( _SC_NPROCESSORS_ONLN );
+  if( v > 0 ) s[2] = (double)v;
+#endif
+
+  UNPROTECT(1);
+
+  return( sizes );
+
+}
@@ -5,6 +5,57 @@
 
 #include "LPI.h"
 
+/*
+   Data accumulation from sparse theory rows, only the
+   non-zero runs of each row are visited.
+
+   Arguments:
+    q     Diagonal of the precision matrix
+    y     Modified measurement vector
+    a     Values of the sparse rows
+    ir    Index vector of the sparse rows
+    m     Measurements
+    v     Measurement variances
+    nr    Number of theory rows
+
+*/
+
+static void deco_add_sparse( Rcomplex * restrict q , Rcomplex * restrict y , const Rcomplex * a , const int * ir , const Rcomplex * m , const double * v , const int nr )
+{
+  const int * runs;
+  int nrun;
+  int l;
+  int r;
+  int i;
+  int i1;
+
+  for( l = 0 ; l < nr ; ++l ){
+
+    nrun = ir[0];
+    runs = ir + 1;
+
+    for( r = 0 ; r < nrun ; ++r ){
+      i1 = runs[ 2 * r ] + runs[ 2 * r + 1 ];
+      for( i = runs[ 2 * r ] ; i < i1 ; ++i ){
+
+        // Add information (only diaonal)
+        q[i].r += ( a->r * a->r + a->i * a->i ) / v[l];
+        q[i].i += ( a->r * a->i - a->i * a->r ) / v[l];
+
+        // Add the corresponding measurement to the y-vector
+        y[i].r += ( m[l].r * a->r + m[l].i * a->i ) / v[l];
+        y[i].i += ( m[l].i * a->r - m[l].r * a->i ) / v[l];
+
+        ++a;
+      }
+    }
+
+    // The next row
+    ir += 2 * nrun + 1;
+
+  }
+}
+
 /* 
    Matched filter decoding, modified from fishs_add.
 
@@ -17,13 +68,15 @@
     var   Measurement variances
     nx    Number of unknowns
     nrow  Number of theory rows in arows
+    sparse 0 for dense theory rows, otherwise the rows
+          are in the run-length format of sparse_row_runs
 
    Returns:
     success 1 if the processing was succesful, 0 otherwise
 
 */
 
-SEXP deco_add(  SEXP Qvec , SEXP yvec , const SEXP arows , const SEXP irows , const SEXP meas  , const SEXP var  , const SEXP nx   , const SEXP nrow  )
+SEXP deco_add(  SEXP Qvec , SEXP yvec , const SEXP arows , const SEXP irows , const SEXP meas  , const SEXP var  , const SEXP nx   , const SEXP nrow , const SEXP sparse )
 {
   Rcomplex *q = COMPLEX(Qvec);
   Rcomplex * restrict qtmp;
@@ -58,6 +111,16 @@ SEXP deco_add(  SEXP Qvec , SEXP yvec , const SEXP arows , const SEXP irows , co
   // Set the success output
   *i_success = 1;
 
+  // Sparse theory rows
+  if( *LOGICAL(sparse) ){
+
+    deco_add_sparse( q , y , acpy , icpy , mcpy , vcpy , nr );
+
+    UNPROTECT(1);
+
+    return(success);
+  }
+
   // Go through all theory matrix rows
   for( l = 0 ; l < nr ; ++l ){
 
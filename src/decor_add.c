@@ -4,6 +4,64 @@
 
 #include "LPI.h"
 
+/*
+   Data accumulation from sparse theory rows, only the
+   non-zero runs of each row are visited.
+
+   Arguments:
+    qR      Diagonal of the precision matrix
+    yR, yI  Modified measurement vector
+    aR, aI  Whitened values of the sparse rows
+    ir      Index vector of the sparse rows
+    mR, mI  Whitened measurements
+    nr      Number of theory rows
+
+   Returns:
+    n_adds  Number of added elements
+
+*/
+
+static int64_t decor_add_sparse( double * restrict qR , double * restrict yR , double * restrict yI , const double * aR , const double * aI , const int * ir , const double * mR , const double * mI , const int nr )
+{
+  const int * runs;
+  int64_t n_adds = 0;
+  int nrun;
+  int l;
+  int a;
+  int i;
+  int i1;
+
+  for( l = 0 ; l < nr ; ++l ){
+
+    nrun = ir[0];
+    runs = ir + 1;
+
+    for( a = 0 ; a < nrun ; ++a ){
+      i1 = runs[ 2 * a ] + runs[ 2 * a + 1 ];
+#pragma GCC ivdep
+      for( i = runs[ 2 * a ] ; i < i1 ; ++i ){
+
+        // Add information, the imaginary part is always zero
+        qR[i] += ( *aR * *aR + *aI * *aI );
+
+        // Add the corresponding measurement to the y-vector
+        yR[i] += ( mR[l] * *aR + mI[l] * *aI );
+        yI[i] += ( mI[l] * *aR - mR[l] * *aI );
+
+        ++aR;
+        ++aI;
+      }
+      n_adds += runs[ 2 * a + 1 ];
+    }
+
+    // The next row
+    ir += 2 * nrun + 1;
+
+  }
+
+  return(n_adds);
+}
+
 /* 
    Matched filter decoder. With re and im in separate arrays.
 
@@ -19,13 +77,16 @@
     var    Measurement variances
     nx     Number of unknowns
     nrow   Number of theory rows in arows
+    flops  Floating point operation counter
+    sparse 0 for dense theory rows, otherwise the rows
+           are in the run-length format of sparse_row_runs
 
    Returns:
     success 1 if the processing was successful, 0 otherwise
 
 */
 
-SEXP decor_add( SEXP QvecR , SEXP yvecR , SEXP yvecI , const SEXP arowsR , const SEXP arowsI , SEXP irows , const SEXP measR , const SEXP measI  , const SEXP var  , const SEXP nx   , const SEXP nrow , SEXP flops )               
+SEXP decor_add( SEXP QvecR , SEXP yvecR , SEXP yvecI , const SEXP arowsR , const SEXP arowsI , SEXP irows , const SEXP measR , const SEXP measI  , const SEXP var  , const SEXP nx   , const SEXP nrow , SEXP flops , const SEXP sparse )               
 {
   double *qR = REAL(QvecR);
   double * restrict qtmpR;
@@ -35,16 +96,16 @@ SEXP decor_add( SEXP QvecR , SEXP yvecR , SEXP yvecI , const SEXP arowsR , const
   double * restrict ytmpR;
   double * restrict ytmpI;
 
-  double *acpyR = REAL(arowsR);
-  double *acpyI = REAL(arowsI);
+  double *acpyR;
+  double *acpyI;
   double *atmpR;
   double *atmpI;
 
   int *icpy = LOGICAL(irows);  
   int *itmp;  
 
-  double * restrict mcpyR = REAL(measR);
-  double * restrict mcpyI = REAL(measI);
+  double * restrict mcpyR;
+  double * restrict mcpyI;
 
   double * restrict vcpy = REAL(var);
 
@@ -78,47 +139,94 @@ SEXP decor_add( SEXP QvecR , SEXP yvecR , SEXP yvecI , const SEXP arowsR , const
   // set the success output (will always be 1 at the moment..)
   *i_success = 1;
 
+  // Sparse theory rows, whitened in place or into
+  // double precision work space
+  if( *LOGICAL(sparse) ){
+
+    if( TYPEOF(arowsR) == RAWSXP ){
+      n_adds = sparse_rows_nval( icpy , nr );
+      acpyR = (double*) R_alloc( n_adds , sizeof(double) );
+      acpyI = (double*) R_alloc( n_adds , sizeof(double) );
+      mcpyR = (double*) R_alloc( nr , sizeof(double) );
+      mcpyI = (double*) R_alloc( nr , sizeof(double) );
+      sparse_rows_whiten( icpy , nr , vcpy , (float*)RAW(arowsR) , (float*)RAW(arowsI) , (float*)RAW(measR) , (float*)RAW(measI) , acpyR , acpyI , mcpyR , mcpyI );
+    }else{
+      acpyR = REAL(arowsR);
+      acpyI = REAL(arowsI);
+      mcpyR = REAL(measR);
+      mcpyI = REAL(measI);
+      sparse_rows_whiten( icpy , nr , vcpy , NULL , NULL , NULL , NULL , acpyR , acpyI , mcpyR , mcpyI );
+    }
+
+    n_adds = decor_add_sparse( qR , yR , yI , acpyR , acpyI , icpy , mcpyR , mcpyI , nr );
+
+    *flop_count += 12.*((double)(n_adds));
+
+    UNPROTECT(1);
+
+    return(success);
+  }
+
 
   
 
 
 
-  // noise whitening (divide A and m with sqrt(var) )
-  atmpR = acpyR;
-  atmpI = acpyI;
-  itmp = icpy;
-  mtmpR = mcpyR;
-  mtmpI = mcpyI;
+  // noise whitening (divide A and m with sqrt(var) ).
+  // Single precision theory rows and measurements are
+  // whitened into double precision work space.
+  if( TYPEOF(arowsR) == RAWSXP ){
 
-  // Go through all theory matrix rows
-  for( l = 0 ; l < nr ; ++l ){
+    acpyR = (double*) R_alloc( (size_t)nr * n , sizeof(double) );
+    acpyI = (double*) R_alloc( (size_t)nr * n , sizeof(double) );
+    mcpyR = (double*) R_alloc( nr , sizeof(double) );
+    mcpyI = (double*) R_alloc( nr , sizeof(double) );
+    whiten_rows_float( (float*)RAW(arowsR) , (float*)RAW(arowsI) , icpy , (float*)RAW(measR) , (float*)RAW(measI) , vcpy , n , nr , acpyR , acpyI , mcpyR , mcpyI );
 
-    std = sqrt(*vcpy);
-    
-    // Go through all range gates
-    for( i = 0 ; i < n ; ++i ){
+  }else{
 
-      // divide only if this sample will be used
-      if(*itmp){
-	*atmpR = *atmpR / std;
-	*atmpI = *atmpI / std;
-      }
+    acpyR = REAL(arowsR);
+    acpyI = REAL(arowsI);
+    mcpyR = REAL(measR);
+    mcpyI = REAL(measI);
+
+    atmpR = acpyR;
+    atmpI = acpyI;
+    itmp = icpy;
+    mtmpR = mcpyR;
+    mtmpI = mcpyI;
+
+    // Go through all theory matrix rows
+    for( l = 0 ; l < nr ; ++l ){
+
+      std = sqrt(*vcpy);
+    
+      // Go through all range gates
+      for( i = 0 ; i < n ; ++i ){
+
+        // divide only if this sample will be used
+        if(*itmp){
+	  *atmpR = *atmpR / std;
+	  *atmpI = *atmpI / std;
+        }
       
-      // Increment the theory matrix counter
-      ++atmpR;
-      ++atmpI;
-      ++itmp;
+        // Increment the theory matrix counter
+        ++atmpR;
+        ++atmpI;
+        ++itmp;
       
-    }
+      }
 
-    // divide the measurement with std
-    *mtmpR = *mtmpR / std;
-    *mtmpI = *mtmpI / std;
+      // divide the measurement with std
+      *mtmpR = *mtmpR / std;
+      *mtmpI = *mtmpI / std;
     
-    // Increment the variance and measurement vector counters
-    ++vcpy;
-    ++mtmpR;
-    ++mtmpI;
+      // Increment the variance and measurement vector counters
+      ++vcpy;
+      ++mtmpR;
+      ++mtmpI;
+
+    }
 
   }
 
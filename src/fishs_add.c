@@ -5,6 +5,98 @@
 
 #include "LPI.h"
 
+/*
+   Data accumulation from sparse theory rows. Only
+   the products of elements within the non-zero runs
+   of each row are added to Q.
+
+   Arguments:
+    q     Upper triangular part of the Fisher
+          information matrix
+    y     Modified measurement vector
+    a     Values of the sparse rows
+    ir    Index vector of the sparse rows
+    m     Measurements
+    v     Measurement variances
+    n     Number of unknowns
+    nr    Number of theory rows
+
+   Returns:
+    n_adds  Number of added elements
+
+*/
+
+static int64_t fishs_add_sparse( Rcomplex * q , Rcomplex * y , const Rcomplex * a , const int * ir , const Rcomplex * m , const double * v , const int n , const int nr )
+{
+  const int * runs;
+  const Rcomplex * restrict p;
+  Rcomplex * restrict qtmp;
+  Rcomplex x;
+  int64_t n_adds = 0;
+  int64_t qi;
+  int64_t va;
+  int64_t vb;
+  int nrun;
+  int l;
+  int r;
+  int b;
+  int i;
+  int j;
+  int ja;
+  int jb;
+  int nb;
+
+  for( l = 0 ; l < nr ; ++l ){
+
+    nrun = ir[0];
+    runs = ir + 1;
+
+    // Go through all non-zero elements of the row
+    va = 0;
+    for( r = 0 ; r < nrun ; ++r ){
+      for( ja = 0 ; ja < runs[ 2 * r + 1 ] ; ++ja ){
+
+        i = runs[ 2 * r ] + ja;
+        x = a[ va + ja ];
+
+        // Element (i,j) of the packed upper triangle is at qi + j
+        qi = (int64_t)i * n - ( (int64_t)i * ( i - 1 ) ) / 2 - i;
+
+        // Columns j >= i in this run and in the later runs
+        vb = va;
+        jb = ja;
+        for( b = r ; b < nrun ; ++b ){
+          nb = runs[ 2 * b + 1 ];
+          qtmp = q + qi + runs[ 2 * b ];
+          p = a + vb;
+#pragma GCC ivdep
+          for( j = jb ; j < nb ; ++j ){
+            qtmp[j].r += ( x.r * p[j].r + x.i * p[j].i ) / v[l];
+            qtmp[j].i += ( x.r * p[j].i - x.i * p[j].r ) / v[l];
+          }
+          n_adds += nb - jb;
+          vb += nb;
+          jb = 0;
+        }
+
+        // Add the corresponding measurement to the y-vector
+        y[i].r += ( m[l].r * x.r + m[l].i * x.i ) / v[l];
+        y[i].i += ( m[l].i * x.r - m[l].r * x.i ) / v[l];
+        n_adds++;
+
+      }
+      va += runs[ 2 * r + 1 ];
+    }
+
+    // The next row
+    a += va;
+    ir += 2 * nrun + 1;
+
+  }
+
+  return(n_adds);
+}
+
 /* 
    Inverse problem solver using direct calculation of the 
    Fisher information matrix. Data accumulation.
@@ -19,13 +111,15 @@
     var   Measurement variances
     nx    Number of unknowns
     nrow  Number of theory rows in arows
+    sparse 0 for dense theory rows, otherwise the rows
+          are in the run-length format of sparse_row_runs
 
    Returns:
     success 1 if the processing was successful, 0 otherwise
 
 */
 
-SEXP fishs_add( SEXP Qvec , SEXP yvec , const SEXP arows , const SEXP irows , const SEXP meas  , const SEXP var  , const SEXP nx   , const SEXP nrow  )               
+SEXP fishs_add( SEXP Qvec , SEXP yvec , const SEXP arows , const SEXP irows , const SEXP meas  , const SEXP var  , const SEXP nx   , const SEXP nrow , const SEXP sparse )               
 {
   Rcomplex *q = COMPLEX(Qvec);
   Rcomplex * restrict qtmp;
@@ -63,6 +157,17 @@ SEXP fishs_add( SEXP Qvec , SEXP yvec , const SEXP arows , const SEXP irows , co
   // set the success output
   *i_success = 1;
 
+  // Sparse theory rows
+  if( *LOGICAL(sparse) ){
+
+    // Use the return value as a flop counter also here
+    *i_success += 10 * (int)fishs_add_sparse( q , y , acpy , icpy , mcpy , vcpy , n , nr );
+
+    UNPROTECT(1);
+
+    return(success);
+  }
+
   // Go through all theory matrix rows
   for( l = 0 ; l < nr ; ++l ){
 
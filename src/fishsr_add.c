@@ -4,6 +4,264 @@
 
 #include "LPI.h"
 
+/*
+   Data accumulation from sparse theory rows.
+
+   The rows are added in panels of FISHSR_PANEL rows. The
+   rows of a panel are scattered into a dense work space
+   over the union of their non-zero runs, and each row of
+   Q is updated with all rows of the panel at once, as a
+   Hermitian rank-k update. A row of Q is thus loaded from
+   memory once per panel instead of once per theory row,
+   and the rows of the panel are added four at a time.
+   Only products of elements within the union of the runs
+   are added to Q, and the operation count is that of the
+   non-zero elements of each row.
+
+   Arguments:
+    qR, qI  Upper triangular part of the Fisher
+            information matrix
+    yR, yI  Modified measurement vector
+    aR, aI  Whitened values of the sparse rows
+    ir      Index vector of the sparse rows
+    mR, mI  Whitened measurements
+    n       Number of unknowns
+    nr      Number of theory rows
+    wR, wI  Work space of FISHSR_PANEL * n values
+    cover   Work space of 2 * n + 2 values
+    tile    Tile size of a tiled Q, 0 for the row-packed
+            upper triangle, see tile_offset
+    band    Number of stored diagonals of a banded Q, 0 if
+            Q is not banded, see fishsr.init. A row with
+            non-zero elements farther apart than the band
+            is an error, Q cannot hold their products.
+
+   Returns:
+    n_adds  Number of added elements
+
+*/
+
+int64_t fishsr_add_rows( double * qR , double * qI , double * yR , double * yI , const double * aR , const double * aI , const int * ir , const double * mR , const double * mI , const int n , const int nr , double * restrict wR , double * restrict wI , int * cover , const int tile , const int band )
+{
+  const int * runs;
+  const double * p0R;
+  const double * p0I;
+  const double * p1R;
+  const double * p1I;
+  const double * p2R;
+  const double * p2I;
+  const double * p3R;
+  const double * p3I;
+  double * restrict qtmpR;
+  double * restrict qtmpI;
+  int * uruns = cover + n;
+  int lrow[ FISHSR_PANEL ];
+  double xR;
+  double xI;
+  double x0R;
+  double x0I;
+  double x1R;
+  double x1I;
+  double x2R;
+  double x2I;
+  double x3R;
+  double x3I;
+  int64_t n_adds = 0;
+  int64_t qi;
+  int64_t qo;
+  int64_t va;
+  int64_t nnz;
+  int nrun;
+  int np;
+  int nl;
+  int l0;
+  int l;
+  int a;
+  int b;
+  int i;
+  int j;
+  int ja;
+  int j0;
+  int j1;
+  int je;
+  int jb;
+
+  for( l0 = 0 ; l0 < nr ; l0 += FISHSR_PANEL ){
+
+    np = ( ( nr - l0 ) < FISHSR_PANEL ? ( nr - l0 ) : FISHSR_PANEL );
+
+    // Union of the non-zero runs of the panel
+    for( i = 0 ; i < n ; ++i ){
+      cover[i] = 0;
+    }
+    runs = ir;
+    for( l = 0 ; l < np ; ++l ){
+      nrun = *runs++;
+      for( a = 0 ; a < nrun ; ++a ){
+        for( i = runs[ 2 * a ] ; i < ( runs[ 2 * a ] + runs[ 2 * a + 1 ] ) ; ++i ){
+          cover[i] = 1;
+        }
+      }
+      runs += 2 * nrun;
+    }
+    sparse_row_runs( cover , n , uruns );
+
+    // Scatter the rows to the panel, zeros elsewhere
+    // in the union
+    va = 0;
+    for( l = 0 ; l < np ; ++l ){
+
+      for( a = 0 ; a < uruns[0] ; ++a ){
+        for( i = uruns[ 2 * a + 1 ] ; i < ( uruns[ 2 * a + 1 ] + uruns[ 2 * a + 2 ] ) ; ++i ){
+          wR[ (int64_t)l * n + i ] = 0.0;
+          wI[ (int64_t)l * n + i ] = 0.0;
+        }
+      }
+
+      nrun = ir[0];
+      runs = ir + 1;
+
+      // Number of non-zero elements of the row
+      nnz = 0;
+      for( a = 0 ; a < nrun ; ++a ){
+        nnz += runs[ 2 * a + 1 ];
+      }
+
+      for( a = 0 ; a < nrun ; ++a ){
+
+        // Products of the elements of this run with the
+        // columns j >= i of the row, and the y-vector
+        nnz -= runs[ 2 * a + 1 ];
+        n_adds += ( (int64_t)runs[ 2 * a + 1 ] * ( runs[ 2 * a + 1 ] + 1 ) ) / 2 + (int64_t)runs[ 2 * a + 1 ] * nnz + runs[ 2 * a + 1 ];
+
+        for( ja = 0 ; ja < runs[ 2 * a + 1 ] ; ++ja ){
+
+          i = runs[ 2 * a ] + ja;
+          xR = aR[ va ];
+          xI = aI[ va ];
+          ++va;
+
+          wR[ (int64_t)l * n + i ] = xR;
+          wI[ (int64_t)l * n + i ] = xI;
+
+          // Add the corresponding measurement to the y-vector
+          yR[i] += ( mR[ l0 + l ] * xR + mI[ l0 + l ] * xI );
+          yI[i] += ( mI[ l0 + l ] * xR - mR[ l0 + l ] * xI );
+
+        }
+      }
+
+      // The next row
+      ir += 2 * nrun + 1;
+
+    }
+    aR += va;
+    aI += va;
+
+    // Rank-k update of the rows of Q in the union
+    for( a = 0 ; a < uruns[0] ; ++a ){
+      for( i = uruns[ 2 * a + 1 ] ; i < ( uruns[ 2 * a + 1 ] + uruns[ 2 * a + 2 ] ) ; ++i ){
+
+        // Rows of the panel with element i in their runs
+        nl = 0;
+        for( l = 0 ; l < np ; ++l ){
+          if( ( wR[ (int64_t)l * n + i ] != 0.0 ) | ( wI[ (int64_t)l * n + i ] != 0.0 ) ){
+            lrow[ nl++ ] = l;
+          }
+        }
+
+        // Element (i,j) of the packed upper triangle is at qi + j
+        qi = (int64_t)i * n - ( (int64_t)i * ( i - 1 ) ) / 2 - i;
+
+        // Columns j >= i in this run and in the later runs,
+        // within one tile at a time if Q is tiled, and the
+        // band and background column separately if Q is banded
+        for( b = a ; b < uruns[0] ; ++b ){
+          jb = uruns[ 2 * b + 1 ] + uruns[ 2 * b + 2 ];
+          for( j0 = ( b == a ? i : uruns[ 2 * b + 1 ] ) ; j0 < jb ; j0 = j1 ){
+            if( tile ){
+              j1 = ( j0 / tile + 1 ) * tile;
+              j1 = ( j1 < jb ? j1 : jb );
+              je = j1;
+              qo = tile_offset( i , j0 / tile , n , tile );
+            }else if( band ){
+              if( j0 < ( n - 1 ) ){
+                j1 = ( jb < ( n - 1 ) ? jb : ( n - 1 ) );
+                je = ( j1 < ( i + band ) ? j1 : ( i + band ) );
+                qo = (int64_t)i * band - i;
+              }else{
+                j1 = jb;
+                je = jb;
+                qo = (int64_t)( n - 1 ) * band + i - ( n - 1 );
+              }
+            }else{
+              j1 = jb;
+              je = jb;
+              qo = qi;
+            }
+            qtmpR = qR + qo;
+            qtmpI = qI + qo;
+
+            // Products outside the band cannot be stored
+            if( je < j1 ){
+              for( l = 0 ; l < nl ; ++l ){
+                p0R = wR + (int64_t)lrow[l] * n;
+                p0I = wI + (int64_t)lrow[l] * n;
+                for( j = je ; j < j1 ; ++j ){
+                  if( ( p0R[j] != 0.0 ) | ( p0I[j] != 0.0 ) ){
+                    error( "Theory row elements %d and %d are outside the band of %d diagonals" , i + 1 , j + 1 , band );
+                  }
+                }
+              }
+            }
+
+            // Four rows at a time, each element of Q is
+            // loaded and stored once for the four rows
+            for( l = 0 ; l < ( nl - 3 ) ; l += 4 ){
+              p0R = wR + (int64_t)lrow[l] * n;
+              p0I = wI + (int64_t)lrow[l] * n;
+              p1R = wR + (int64_t)lrow[ l + 1 ] * n;
+              p1I = wI + (int64_t)lrow[ l + 1 ] * n;
+              p2R = wR + (int64_t)lrow[ l + 2 ] * n;
+              p2I = wI + (int64_t)lrow[ l + 2 ] * n;
+              p3R = wR + (int64_t)lrow[ l + 3 ] * n;
+              p3I = wI + (int64_t)lrow[ l + 3 ] * n;
+              x0R = p0R[i];
+              x0I = p0I[i];
+              x1R = p1R[i];
+              x1I = p1I[i];
+              x2R = p2R[i];
+              x2I = p2I[i];
+              x3R = p3R[i];
+              x3I = p3I[i];
+#pragma GCC ivdep
+              for( j = j0 ; j < je ; ++j ){
+                qtmpR[j] += ( x0R * p0R[j] + x0I * p0I[j] ) + ( x1R * p1R[j] + x1I * p1I[j] ) + ( x2R * p2R[j] + x2I * p2I[j] ) + ( x3R * p3R[j] + x3I * p3I[j] );
+                qtmpI[j] += ( x0R * p0I[j] - x0I * p0R[j] ) + ( x1R * p1I[j] - x1I * p1R[j] ) + ( x2R * p2I[j] - x2I * p2R[j] ) + ( x3R * p3I[j] - x3I * p3R[j] );
+              }
+            }
+
+            // The remaining rows one at a time
+            for( ; l < nl ; ++l ){
+              p0R = wR + (int64_t)lrow[l] * n;
+              p0I = wI + (int64_t)lrow[l] * n;
+              x0R = p0R[i];
+              x0I = p0I[i];
+#pragma GCC ivdep
+              for( j = j0 ; j < je ; ++j ){
+                qtmpR[j] += ( x0R * p0R[j] + x0I * p0I[j] );
+                qtmpI[j] += ( x0R * p0I[j] - x0I * p0R[j] );
+              }
+            }
+          }
+        }
+      }
+    }
+  }
+
+  return(n_adds);
+}
+
 /* 
    Inverse problem solver using direct calculation of the 
    Fisher information matrix. Data accumulation.
@@ -18,13 +276,21 @@
     var   Measurement variances
     nx    Number of unknowns
     nrow  Number of theory rows in arows
+    flops Floating point operation counter
+    sparse 0 for dense theory rows, otherwise the rows
+          are in the run-length format of sparse_row_runs
+    tile  Tile size of a tiled Q, 0 for the row-packed
+          upper triangle
+    band  Number of stored diagonals of a banded Q, 0 if Q
+          is not banded. Dense rows are converted to the
+          run-length format if Q is tiled or banded.
 
    Returns:
     success 1 if the processing was successful, 0 otherwise
 
 */
 
-SEXP fishsr_add( SEXP QvecR , SEXP QvecI , SEXP yvecR , SEXP yvecI , const SEXP arowsR , const SEXP arowsI , const SEXP irows , const SEXP measR , const SEXP measI  , const SEXP var  , const SEXP nx   , const SEXP nrow , SEXP flops )               
+SEXP fishsr_add( SEXP QvecR , SEXP QvecI , SEXP yvecR , SEXP yvecI , const SEXP arowsR , const SEXP arowsI , const SEXP irows , const SEXP measR , const SEXP measI  , const SEXP var  , const SEXP nx   , const SEXP nrow , SEXP flops , const SEXP sparse , const SEXP tile , const SEXP band )
 {
   double *qR = REAL(QvecR);
   double *qI = REAL(QvecI);
@@ -36,16 +302,16 @@ SEXP fishsr_add( SEXP QvecR , SEXP QvecI , SEXP yvecR , SEXP yvecI , const SEXP
   double * restrict ytmpR;
   double * restrict ytmpI;
 
-  double *acpyR = REAL(arowsR);
-  double *acpyI = REAL(arowsI);
+  double *acpyR;
+  double *acpyI;
   double *atmpR;
   double *atmpI;
 
   int *icpy = LOGICAL(irows);  
   int *itmp;  
 
-  double * restrict mcpyR = REAL(measR);
-  double * restrict mcpyI = REAL(measI);
+  double * restrict mcpyR;
+  double * restrict mcpyI;
 
   double * restrict vcpy = REAL(var);
 
@@ -53,6 +319,10 @@ SEXP fishsr_add( SEXP QvecR , SEXP QvecI , SEXP yvecR , SEXP yvecI , const SEXP
 
   int nr = *INTEGER(nrow);
 
+  int tl = *INTEGER(tile);
+
+  int bd = *INTEGER(band);
+
   double *flop_count = REAL(flops);
   
 
@@ -70,6 +340,8 @@ SEXP fishsr_add( SEXP QvecR , SEXP QvecI , SEXP yvecR , SEXP yvecI , const SEXP
   double std;
   double * mtmpR;
   double * mtmpI;
+  int64_t v = 0;
+  int64_t n_idx = 0;
 
   // success output
   PROTECT( success = allocVector( LGLSXP , 1 ) );
@@ -80,54 +352,136 @@ SEXP fishsr_add( SEXP QvecR , SEXP QvecI , SEXP yvecR , SEXP yvecI , const SEXP
   // set the success output (will always be 1 at the moment..)
   *i_success = 1;
 
+  // Sparse theory rows, whitened in place or into
+  // double precision work space
+  if( *LOGICAL(sparse) ){
+
+    if( TYPEOF(arowsR) == RAWSXP ){
+      n_adds = sparse_rows_nval( icpy , nr );
+      acpyR = (double*) R_alloc( n_adds , sizeof(double) );
+      acpyI = (double*) R_alloc( n_adds , sizeof(double) );
+      mcpyR = (double*) R_alloc( nr , sizeof(double) );
+      mcpyI = (double*) R_alloc( nr , sizeof(double) );
+      sparse_rows_whiten( icpy , nr , vcpy , (float*)RAW(arowsR) , (float*)RAW(arowsI) , (float*)RAW(measR) , (float*)RAW(measI) , acpyR , acpyI , mcpyR , mcpyI );
+    }else{
+      acpyR = REAL(arowsR);
+      acpyI = REAL(arowsI);
+      mcpyR = REAL(measR);
+      mcpyI = REAL(measI);
+      sparse_rows_whiten( icpy , nr , vcpy , NULL , NULL , NULL , NULL , acpyR , acpyI , mcpyR , mcpyI );
+    }
 
+    // Dense panel of rows, the union of their runs,
+    // and the runs of the union
+    atmpR = (double*) R_alloc( (size_t)FISHSR_PANEL * n , sizeof(double) );
+    atmpI = (double*) R_alloc( (size_t)FISHSR_PANEL * n , sizeof(double) );
+    itmp = (int*) R_alloc( 2 * n + 2 , sizeof(int) );
 
+    n_adds = fishsr_add_rows( qR , qI , yR , yI , acpyR , acpyI , icpy , mcpyR , mcpyI , n , nr , atmpR , atmpI , itmp , tl , bd );
 
+    *flop_count += 8.*((double)(n_adds));
+
+    UNPROTECT(1);
+
+    return(success);
+  }
 
-  // noise whitening (divide A and m with sqrt(var) )
-  atmpR = acpyR;
-  atmpI = acpyI;
-  itmp = icpy;
-  mtmpR = mcpyR;
-  mtmpI = mcpyI;
 
-  // Go through all theory matrix rows
-  for( l = 0 ; l < nr ; ++l ){
 
-    std = sqrt(*vcpy);
+
+
+  // noise whitening (divide A and m with sqrt(var) ).
+  // Single precision theory rows and measurements are
+  // whitened into double precision work space.
+  if( TYPEOF(arowsR) == RAWSXP ){
+
+    acpyR = (double*) R_alloc( (size_t)nr * n , sizeof(double) );
+    acpyI = (double*) R_alloc( (size_t)nr * n , sizeof(double) );
+    mcpyR = (double*) R_alloc( nr , sizeof(double) );
+    mcpyI = (double*) R_alloc( nr , sizeof(double) );
+    whiten_rows_float( (float*)RAW(arowsR) , (float*)RAW(arowsI) , icpy , (float*)RAW(measR) , (float*)RAW(measI) , vcpy , n , nr , acpyR , acpyI , mcpyR , mcpyI );
+
+  }else{
+
+    acpyR = REAL(arowsR);
+    acpyI = REAL(arowsI);
+    mcpyR = REAL(measR);
+    mcpyI = REAL(measI);
+
+    atmpR = acpyR;
+    atmpI = acpyI;
+    itmp = icpy;
+    mtmpR = mcpyR;
+    mtmpI = mcpyI;
+
+    // Go through all theory matrix rows
+    for( l = 0 ; l < nr ; ++l ){
+
+      std = sqrt(*vcpy);
     
-    // Go through all range gates
-    for( i = 0 ; i < n ; ++i ){
+      // Go through all range gates
+      for( i = 0 ; i < n ; ++i ){
 
-      // divide only if this sample will be used
-      if(*itmp){
-	*atmpR = *atmpR / std;
-	*atmpI = *atmpI / std;
-      }
+        // divide only if this sample will be used
+        if(*itmp){
+	  *atmpR = *atmpR / std;
+	  *atmpI = *atmpI / std;
+        }
       
-      // Increment the theory matrix counter
-      ++atmpR;
-      ++atmpI;
-      ++itmp;
+        // Increment the theory matrix counter
+        ++atmpR;
+        ++atmpI;
+        ++itmp;
       
-    }
+      }
 
-    // divide the measurement with std
-    *mtmpR = *mtmpR / std;
-    *mtmpI = *mtmpI / std;
+      // divide the measurement with std
+      *mtmpR = *mtmpR / std;
+      *mtmpI = *mtmpI / std;
     
-    // Increment the variance and measurement vector counters
-    ++vcpy;
-    ++mtmpR;
-    ++mtmpI;
+      // Increment the variance and measurement vector counters
+      ++vcpy;
+      ++mtmpR;
+      ++mtmpI;
+
+    }
 
   }
 
 
 
-  
-  
-  
+  // The tiled and banded Q are updated only in
+  // fishsr_add_rows, collect the non-zero runs of the
+  // whitened rows
+  if( tl | bd ){
+
+    itmp = (int*) R_alloc( (size_t)nr * ( n + 2 ) , sizeof(int) );
+    atmpR = (double*) R_alloc( (size_t)nr * n , sizeof(double) );
+    atmpI = (double*) R_alloc( (size_t)nr * n , sizeof(double) );
+    for( l = 0 ; l < nr ; ++l ){
+      n_idx += sparse_row_runs( icpy + (int64_t)l * n , n , itmp + n_idx );
+      for( i = 0 ; i < n ; ++i ){
+        if( icpy[ (int64_t)l * n + i ] ){
+          atmpR[v] = acpyR[ (int64_t)l * n + i ];
+          atmpI[v] = acpyI[ (int64_t)l * n + i ];
+          ++v;
+        }
+      }
+    }
+
+    acpyR = (double*) R_alloc( (size_t)FISHSR_PANEL * n , sizeof(double) );
+    acpyI = (double*) R_alloc( (size_t)FISHSR_PANEL * n , sizeof(double) );
+    icpy = (int*) R_alloc( 2 * n + 2 , sizeof(int) );
+
+    n_adds = fishsr_add_rows( qR , qI , yR , yI , atmpR , atmpI , itmp , mcpyR , mcpyI , n , nr , acpyR , acpyI , icpy , tl , bd );
+
+    *flop_count += 8.*((double)(n_adds));
+
+    UNPROTECT(1);
+
+    return(success);
+  }
+
   // Go through all theory matrix rows
   for( l = 0 ; l < nr ; ++l ){
 
@@ -290,3 +644,50 @@ SEXP fishsr_add( SEXP QvecR , SEXP QvecI , SEXP yvecR , SEXP yvecI , const SEXP
   return(success);
 
 }
+
+
+
+/*
+   Noise whitening of single precision theory rows and
+   measurements. The whitened values are written in
+   double precision, the Fisher information matrix is
+   always accumulated in double precision.
+
+   Arguments:
+    aR    Theory matrix rows, real part
+    aI    Theory matrix rows, imaginary part
+    ir    Indices of non-zero theory matrix elements
+    mR    Measurements, real part
+    mI    Measurements, imaginary part
+    var   Measurement variances
+    n     Number of unknowns
+    nr    Number of theory rows
+    aRo   Whitened theory rows, real part
+    aIo   Whitened theory rows, imaginary part
+    mRo   Whitened measurements, real part
+    mIo   Whitened measurements, imaginary part
+
+*/
+
+void whiten_rows_float( const float * aR , const float * aI , const int * ir , const float * mR , const float * mI , const double * var , const int n , const int nr , double * aRo , double * aIo , double * mRo , double * mIo )
+{
+  int64_t i;
+  int l;
+  double std;
+
+  // Go through all theory matrix rows
+  for( l = 0 ; l < nr ; ++l ){
+
+    std = sqrt( var[l] );
+
+    // Unused elements are copied as such
+    for( i = (int64_t)l * n ; i < ( (int64_t)l + 1 ) * n ; ++i ){
+      aRo[i] = ir[i] ? aR[i] / std : aR[i];
+      aIo[i] = ir[i] ? aI[i] / std : aI[i];
+    }
+
+    mRo[l] = mR[l] / std;
+    mIo[l] = mI[l] / std;
+
+  }
+}
@@ -0,0 +1,406 @@
+// file:fishsr_band.c
+// (c) 2010- University of Oulu, Finland
+// Written by Ilkka Virtanen <ilkka.i.virtanen@oulu.fi>
+// Licensed under FreeBSD license.
+
+#include "LPI.h"
+
+/*
+  Bandwidth of the Fisher information matrix.
+
+  A theory row has non-zero values only at the range gates
+  that contain samples of the transmission, so apart from
+  the background column the Fisher information matrix is
+  banded. The number of superdiagonals is the largest
+  difference of the first and last non-zero range gate of
+  a theory row. The range ambiguity function index of any
+  lag is zero where the transmitter index is zero, the
+  width calculated from the transmitter index is thus an
+  upper limit for all lags.
+
+  Arguments:
+   idata    Transmitter sample indices
+   ndata    Data vector length
+   rlims    Range gate limits
+   nranges  Number of range gates
+
+  Returns:
+   bw       Number of superdiagonals in the range gate
+            part of the Fisher information matrix
+
+*/
+
+SEXP fishsr_band_width( SEXP idata , SEXP ndata , SEXP rlims , SEXP nranges )
+{
+  const int * id = LOGICAL(idata);
+  const int n_data = *INTEGER(ndata);
+  const int * r_lims = INTEGER(rlims);
+  const int n_ranges = *INTEGER(nranges);
+  int * gate;
+  SEXP ans;
+  int64_t k;
+  int64_t s0 = 0;
+  int64_t s1 = -1;
+  int64_t p1 = 0;
+  int bw = 0;
+  int i;
+  int d;
+
+  PROTECT( ans = allocVector( INTSXP , 1 ) );
+
+  // Range gate of each delay from r_lims[0]
+  gate = (int*) R_alloc( r_lims[ n_ranges ] - r_lims[0] , sizeof(int) );
+  for( i = 0 ; i < n_ranges ; ++i ){
+    for( d = r_lims[i] ; d < r_lims[ i + 1 ] ; ++d ){
+      gate[ d - r_lims[0] ] = i;
+    }
+  }
+
+  // The row of sample k contains the samples from
+  // k - r_lims[n_ranges] + 1 to k - r_lims[0]. s1 is the
+  // last and s0 the first non-zero sample in this window,
+  // both move only forward with k
+  for( k = r_lims[ n_ranges ] ; k < n_data ; ++k ){
+
+    for( ; ( p1 <= ( k - r_lims[0] ) ) & ( p1 < n_data ) ; ++p1 ){
+      if( id[p1] ) s1 = p1;
+    }
+
+    // No transmission in this row
+    if( s1 <= ( k - r_lims[ n_ranges ] ) ) continue;
+
+    if( s0 <= ( k - r_lims[ n_ranges ] ) ) s0 = k - r_lims[ n_ranges ] + 1;
+    while( !id[s0] ) ++s0;
+
+    d = gate[ k - s0 - r_lims[0] ] - gate[ k - s1 - r_lims[0] ];
+    bw = ( d > bw ? d : bw );
+
+  }
+
+  *INTEGER(ans) = bw;
+
+  UNPROTECT(1);
+
+  return(ans);
+
+}
+
+/*
+  Solution of a banded Fisher information matrix.
+
+  The range gate part of Q is stored in band format, row i
+  holds the elements i ... i + band - 1, and the background
+  column is stored after the band, see fishsr.init. The
+  diagonal of Q is scaled to unity and the unmeasured
+  points get unit diagonal values, as in the dense
+  fishsr.solve. The band is factorized with a banded
+  Cholesky decomposition and the background column is
+  eliminated with its Schur complement, which is a scalar.
+  If only the variances are needed, the inverse of the band
+  is calculated only within the band with
+  fishsr_band_inverse.
+
+  Arguments:
+   QvecR      Banded Fisher information matrix, real part
+   QvecI      Imaginary part
+   yvecR      Modified measurement vector, real part
+   yvecI      Imaginary part
+   nx         Number of unknowns
+   band       Number of stored diagonals
+   fullcovar  TRUE if the full covariance matrix is
+              calculated, otherwise only the variances
+
+  Returns:
+   ans        A list with the solution and the covariance,
+              NA at unmeasured points, and everywhere if Q
+              is not positive definite
+
+*/
+
+SEXP fishsr_band_solve( SEXP QvecR , SEXP QvecI , SEXP yvecR , SEXP yvecI , SEXP nx , SEXP band , SEXP fullcovar )
+{
+  const double * qR = REAL(QvecR);
+  const double * qI = REAL(QvecI);
+  const double * yR = REAL(yvecR);
+  const double * yI = REAL(yvecI);
+  const int n = *INTEGER(nx);
+  const int nd = *INTEGER(band);
+  const int full = *LOGICAL(fullcovar);
+  const int m = n - 1;
+  const int64_t qb = (int64_t)m * nd;
+  const int two = 2;
+  char *cnames[2] = {"solution","covariance"};
+  SEXP ans;
+  SEXP sol;
+  SEXP cov;
+  SEXP names;
+  Rcomplex * x;
+  Rcomplex * c;
+  Rcomplex * ab;
+  Rcomplex * b;
+  Rcomplex * uw;
+  Rcomplex * z;
+  double * s;
+  int * na;
+  double sch;
+  double bwR;
+  double bwI;
+  double x2R;
+  double x2I;
+  double v;
+  int kd;
+  int ldab;
+  int info;
+  int i;
+  int j;
+  int t;
+
+  // Bandwidth of the factorization
+  kd = ( ( nd - 1 ) < ( m - 1 ) ? ( nd - 1 ) : ( m - 1 ) );
+  ldab = kd + 1;
+
+  // Output list ans[[1]] = solution , ans[[2]] = covariance
+  PROTECT( ans = allocVector( VECSXP , 2 ) );
+  PROTECT( sol = allocVector( CPLXSXP , n ) );
+  if( full ){
+    PROTECT( cov = allocMatrix( CPLXSXP , n , n ) );
+  }else{
+    PROTECT( cov = allocVector( CPLXSXP , n ) );
+  }
+  x = COMPLEX(sol);
+  c = COMPLEX(cov);
+
+  // Scaling of the diagonal, the unmeasured points
+  // have zero diagonal and get unit values
+  s = (double*) R_alloc( n , sizeof(double) );
+  na = (int*) R_alloc( n , sizeof(int) );
+  for( i = 0 ; i < n ; ++i ){
+    v = ( i < m ? qR[ (int64_t)i * nd ] : qR[ qb + m ] );
+    na[i] = ( v == 0.0 );
+    s[i] = ( na[i] ? 1.0 : sqrt(v) );
+  }
+
+  // The scaled band in the lower band storage of LAPACK,
+  // the lower triangle is the conjugate of the upper one
+  ab = (Rcomplex*) R_alloc( (size_t)ldab * m , sizeof(Rcomplex) );
+  for( i = 0 ; i < m ; ++i ){
+    for( t = 0 ; t < ldab ; ++t ){
+      if( ( i + t ) < m ){
+        ab[ (int64_t)i * ldab + t ].r = qR[ (int64_t)i * nd + t ] / ( s[i] * s[ i + t ] );
+        ab[ (int64_t)i * ldab + t ].i = -qI[ (int64_t)i * nd + t ] / ( s[i] * s[ i + t ] );
+      }else{
+        ab[ (int64_t)i * ldab + t ].r = 0.0;
+        ab[ (int64_t)i * ldab + t ].i = 0.0;
+      }
+    }
+    if( na[i] ){
+      ab[ (int64_t)i * ldab ].r = 1.0;
+      ab[ (int64_t)i * ldab ].i = 0.0;
+    }
+  }
+
+  // The scaled background column b, and the right hand
+  // sides b and y of the band solution
+  b = (Rcomplex*) R_alloc( m , sizeof(Rcomplex) );
+  uw = (Rcomplex*) R_alloc( 2 * (size_t)m , sizeof(Rcomplex) );
+  for( i = 0 ; i < m ; ++i ){
+    b[i].r = qR[ qb + i ] / ( s[i] * s[m] );
+    b[i].i = qI[ qb + i ] / ( s[i] * s[m] );
+    uw[i] = b[i];
+    uw[ m + i ].r = yR[i] / s[i];
+    uw[ m + i ].i = yI[i] / s[i];
+  }
+
+  // Cholesky factorization of the band and the products
+  // u = A^-1 b and w = A^-1 y
+  F77_CALL(zpbtrf)( "L" , &m , &kd , ab , &ldab , &info FCONE );
+  if( info == 0 ){
+    F77_CALL(zpbtrs)( "L" , &m , &kd , &two , ab , &ldab , uw , &m , &info FCONE );
+  }
+
+  // The Schur complement of the band, the scaled
+  // diagonal element of the background is 1
+  sch = 1.0;
+  bwR = yR[m] / s[m];
+  bwI = yI[m] / s[m];
+  for( i = 0 ; i < m ; ++i ){
+    sch -= ( b[i].r * uw[i].r + b[i].i * uw[i].i );
+    bwR -= ( b[i].r * uw[ m + i ].r + b[i].i * uw[ m + i ].i );
+    bwI -= ( b[i].r * uw[ m + i ].i - b[i].i * uw[ m + i ].r );
+  }
+
+  // Q is not positive definite
+  if( ( info != 0 ) | !( sch > 0.0 ) ){
+    for( i = 0 ; i < n ; ++i ){
+      x[i].r = x[i].i = NA_REAL;
+    }
+    for( i = 0 ; i < LENGTH(cov) ; ++i ){
+      c[i].r = c[i].i = NA_REAL;
+    }
+
+  }else{
+
+    // The solution
+    x2R = bwR / sch;
+    x2I = bwI / sch;
+    for( i = 0 ; i < m ; ++i ){
+      x[i].r = ( uw[ m + i ].r - ( uw[i].r * x2R - uw[i].i * x2I ) ) / s[i];
+      x[i].i = ( uw[ m + i ].i - ( uw[i].r * x2I + uw[i].i * x2R ) ) / s[i];
+    }
+    x[m].r = x2R / s[m];
+    x[m].i = x2I / s[m];
+
+    if( full ){
+
+      // Inverse of the band, the background column
+      // and the Schur complement correction
+      for( j = 0 ; j < n ; ++j ){
+        for( i = 0 ; i < n ; ++i ){
+          c[ (int64_t)j * n + i ].r = ( i == j ? 1.0 : 0.0 );
+          c[ (int64_t)j * n + i ].i = 0.0;
+        }
+      }
+      F77_CALL(zpbtrs)( "L" , &m , &kd , &m , ab , &ldab , c , &n , &info FCONE );
+      for( j = 0 ; j < m ; ++j ){
+        for( i = 0 ; i < m ; ++i ){
+          c[ (int64_t)j * n + i ].r += ( uw[i].r * uw[j].r + uw[i].i * uw[j].i ) / sch;
+          c[ (int64_t)j * n + i ].i += ( uw[i].i * uw[j].r - uw[i].r * uw[j].i ) / sch;
+        }
+        c[ (int64_t)j * n + m ].r = -uw[j].r / sch;
+        c[ (int64_t)j * n + m ].i = uw[j].i / sch;
+        c[ (int64_t)m * n + j ].r = -uw[j].r / sch;
+        c[ (int64_t)m * n + j ].i = -uw[j].i / sch;
+      }
+      c[ (int64_t)m * n + m ].r = 1.0 / sch;
+      c[ (int64_t)m * n + m ].i = 0.0;
+
+      // Back to unnormalized units
+      for( j = 0 ; j < n ; ++j ){
+        for( i = 0 ; i < n ; ++i ){
+          if( na[i] | na[j] ){
+            c[ (int64_t)j * n + i ].r = c[ (int64_t)j * n + i ].i = NA_REAL;
+          }else{
+            c[ (int64_t)j * n + i ].r /= ( s[i] * s[j] );
+            c[ (int64_t)j * n + i ].i /= ( s[i] * s[j] );
+          }
+        }
+      }
+
+    }else{
+
+      // Only the band of the band inverse is calculated,
+      // its diagonal and the Schur complement correction
+      // give the variances
+      z = (Rcomplex*) R_alloc( (size_t)ldab * m , sizeof(Rcomplex) );
+      fishsr_band_inverse( ab , m , kd , z );
+      for( j = 0 ; j < m ; ++j ){
+        c[j].r = ( z[ (int64_t)j * ldab ].r + ( uw[j].r * uw[j].r + uw[j].i * uw[j].i ) / sch ) / ( s[j] * s[j] );
+        c[j].i = 0.0;
+      }
+      c[m].r = 1.0 / sch / ( s[m] * s[m] );
+      c[m].i = 0.0;
+      for( i = 0 ; i < n ; ++i ){
+        if( na[i] ) c[i].r = c[i].i = NA_REAL;
+      }
+
+    }
+
+    // NA at the unmeasured points
+    for( i = 0 ; i < n ; ++i ){
+      if( na[i] ) x[i].r = x[i].i = NA_REAL;
+    }
+
+  }
+
+  SET_VECTOR_ELT( ans , 0 , sol );
+  SET_VECTOR_ELT( ans , 1 , cov );
+
+  // Set the name attributes
+  PROTECT( names = allocVector( STRSXP , 2 ));
+  SET_STRING_ELT( names , 0 , mkChar( cnames[0] ) );
+  SET_STRING_ELT( names , 1 , mkChar( cnames[1] ) );
+  setAttrib( ans , R_NamesSymbol , names);
+
+  UNPROTECT(4);
+
+  return(ans);
+
+}
+
+/*
+  Band of the inverse of a banded Hermitian matrix from its
+  Cholesky factorization A = L L^H, using the Takahashi
+  recurrence. Z = A^-1 satisfies Z L = L^-H, which is upper
+  triangular with diagonal 1 / l_jj, so the elements of
+  column j of Z within the band are
+
+   Z_ij = delta_ij / l_jj^2 - sum_{k=j+1}^{j+kd} Z_ik L_kj / l_jj
+
+  for i >= j. They depend only on the band of the later
+  columns, and the columns are calculated from the last
+  one backwards with kd^2 operations per column.
+
+  Arguments:
+   ab  Cholesky factor L in the lower band storage of
+       LAPACK, as returned by zpbtrf
+   m   Order of the matrix
+   kd  Number of subdiagonals
+   zb  Output, the lower band of Z in the same storage
+
+*/
+
+void fishsr_band_inverse( const Rcomplex * ab , const int m , const int kd , Rcomplex * zb )
+{
+  const int ldab = kd + 1;
+  const Rcomplex * l;
+  const Rcomplex * z;
+  Rcomplex * zj;
+  double ljj;
+  double sR;
+  double sI;
+  int i;
+  int j;
+  int k;
+  int ke;
+
+  for( j = m - 1 ; j >= 0 ; --j ){
+
+    // Column j of L and Z, l[k-j] = L_kj
+    l = ab + (int64_t)j * ldab;
+    zj = zb + (int64_t)j * ldab;
+    ljj = l[0].r;
+    ke = ( ( j + kd ) < ( m - 1 ) ? ( j + kd ) : ( m - 1 ) );
+
+    // Elements below the diagonal
+    for( i = j + 1 ; i <= ke ; ++i ){
+      sR = 0.0;
+      sI = 0.0;
+
+      // Z_ik , k <= i , from column k
+      for( k = j + 1 ; k <= i ; ++k ){
+        z = zb + (int64_t)k * ldab + ( i - k );
+        sR += z->r * l[ k - j ].r - z->i * l[ k - j ].i;
+        sI += z->r * l[ k - j ].i + z->i * l[ k - j ].r;
+      }
+
+      // Z_ik , k > i , is the conjugate of Z_ki in column i
+      for( ; k <= ke ; ++k ){
+        z = zb + (int64_t)i * ldab + ( k - i );
+        sR += z->r * l[ k - j ].r + z->i * l[ k - j ].i;
+        sI += z->r * l[ k - j ].i - z->i * l[ k - j ].r;
+      }
+
+      zj[ i - j ].r = -sR / ljj;
+      zj[ i - j ].i = -sI / ljj;
+    }
+
+    // The diagonal, Z_jk is the conjugate of Z_kj
+    sR = 0.0;
+    for( k = j + 1 ; k <= ke ; ++k ){
+      sR += zj[ k - j ].r * l[ k - j ].r + zj[ k - j ].i * l[ k - j ].i;
+    }
+    zj[0].r = 1.0 / ( ljj * ljj ) - sR / ljj;
+    zj[0].i = 0.0;
+
+  }
+}
@@ -0,0 +1,209 @@
+// file:fishsr_solve.c
+// (c) 2010- University of Oulu, Finland
+// Written by Ilkka Virtanen <ilkka.i.virtanen@oulu.fi>
+// Licensed under FreeBSD license.
+
+#include "LPI.h"
+
+/*
+  Inverse problem solver using direct calculation of the
+  Fisher information matrix. Final solver function.
+
+  The upper triangle of Q is unpacked from the row-packed
+  or tiled vectors directly to a LAPACK matrix. The
+  diagonal of Q is scaled to unity for better numerical
+  stability, and unit diagonal values are set at the
+  unmeasured points, where the diagonal of Q is zero. The
+  scaled matrix is factorized with a Hermitian Cholesky
+  decomposition, the solution is calculated from the
+  factorization, and the covariance matrix is the inverse
+  of the factorized matrix. If only the variances are
+  needed, Q = U^H U and the diagonal of Q^-1 = U^-1 U^-H
+  is the squared row norms of U^-1, which is calculated
+  in place of the factor without forming the inverse.
+
+  Arguments:
+   QvecR      Upper triangular part of the Fisher
+              information matrix, real part
+   QvecI      Imaginary part
+   yvecR      Modified measurement vector, real part
+   yvecI      Imaginary part
+   nx         Number of unknowns
+   tile       Tile size of a tiled Q, 0 for the row-packed
+              upper triangle
+   fullcovar  TRUE if the full covariance matrix is
+              calculated, otherwise only the variances
+
+  Returns:
+   ans        A list with the solution and the covariance,
+              NA at unmeasured points, and everywhere if Q
+              is not positive definite
+
+*/
+
+SEXP fishsr_solve( SEXP QvecR , SEXP QvecI , SEXP yvecR , SEXP yvecI , SEXP nx , SEXP tile , SEXP fullcovar )
+{
+  const double * qR = REAL(QvecR);
+  const double * qI = REAL(QvecI);
+  const double * yR = REAL(yvecR);
+  const double * yI = REAL(yvecI);
+  const int n = *INTEGER(nx);
+  const int tl = *INTEGER(tile);
+  const int full = *LOGICAL(fullcovar);
+  const int one = 1;
+  char *cnames[2] = {"solution","covariance"};
+  SEXP ans;
+  SEXP sol;
+  SEXP cov;
+  SEXP names;
+  Rcomplex * x;
+  Rcomplex * c;
+  Rcomplex * a;
+  double * s;
+  int * na;
+  int64_t qo = 0;
+  int info;
+  int i;
+  int j;
+
+  // Output list ans[[1]] = solution , ans[[2]] = covariance
+  PROTECT( ans = allocVector( VECSXP , 2 ) );
+  PROTECT( sol = allocVector( CPLXSXP , n ) );
+  x = COMPLEX(sol);
+
+  // The full covariance matrix is calculated in place
+  // of the factorization
+  if( full ){
+    PROTECT( cov = allocMatrix( CPLXSXP , n , n ) );
+    a = COMPLEX(cov);
+  }else{
+    PROTECT( cov = allocVector( CPLXSXP , n ) );
+    a = (Rcomplex*) R_alloc( (size_t)n * n , sizeof(Rcomplex) );
+  }
+  c = COMPLEX(cov);
+
+  // Unpack the upper triangle, column j of the
+  // LAPACK matrix holds the elements (i,j) , i <= j
+  for( i = 0 ; i < n ; ++i ){
+    for( j = i ; j < n ; ++j ){
+      if( tl ){
+        if( ( j == i ) | ( ( j % tl ) == 0 ) ) qo = tile_offset( i , j / tl , n , tl );
+      }else{
+        qo = (int64_t)i * n - ( (int64_t)i * ( i - 1 ) ) / 2 - i;
+      }
+      a[ (int64_t)j * n + i ].r = qR[ qo + j ];
+      a[ (int64_t)j * n + i ].i = qI[ qo + j ];
+    }
+  }
+
+  // Scaling of the diagonal, the unmeasured points
+  // have zero diagonal and get unit values
+  s = (double*) R_alloc( n , sizeof(double) );
+  na = (int*) R_alloc( n , sizeof(int) );
+  for( i = 0 ; i < n ; ++i ){
+    na[i] = ( a[ (int64_t)i * n + i ].r == 0.0 );
+    s[i] = ( na[i] ? 1.0 : sqrt( a[ (int64_t)i * n + i ].r ) );
+  }
+  for( j = 0 ; j < n ; ++j ){
+    for( i = 0 ; i < j ; ++i ){
+      a[ (int64_t)j * n + i ].r /= ( s[i] * s[j] );
+      a[ (int64_t)j * n + i ].i /= ( s[i] * s[j] );
+    }
+    a[ (int64_t)j * n + j ].r = 1.0;
+    a[ (int64_t)j * n + j ].i = 0.0;
+  }
+
+  // Cholesky factorization and the solution
+  // from the scaled measurement vector
+  for( i = 0 ; i < n ; ++i ){
+    x[i].r = yR[i] / s[i];
+    x[i].i = yI[i] / s[i];
+  }
+  F77_CALL(zpotrf)( "U" , &n , a , &n , &info FCONE );
+  if( info == 0 ){
+    F77_CALL(zpotrs)( "U" , &n , &one , a , &n , x , &n , &info FCONE );
+  }
+  if( info == 0 ){
+    if( full ){
+      F77_CALL(zpotri)( "U" , &n , a , &n , &info FCONE );
+    }else{
+      F77_CALL(ztrtri)( "U" , "N" , &n , a , &n , &info FCONE FCONE );
+    }
+  }
+
+  // Q is not positive definite
+  if( info != 0 ){
+    for( i = 0 ; i < n ; ++i ){
+      x[i].r = x[i].i = NA_REAL;
+    }
+    for( i = 0 ; i < LENGTH(cov) ; ++i ){
+      c[i].r = c[i].i = NA_REAL;
+    }
+
+  }else{
+
+    // Back to unnormalized units, NA
+    // at the unmeasured points
+    for( i = 0 ; i < n ; ++i ){
+      if( na[i] ){
+        x[i].r = x[i].i = NA_REAL;
+      }else{
+        x[i].r /= s[i];
+        x[i].i /= s[i];
+      }
+    }
+
+    if( full ){
+
+      // The lower triangle is the complex
+      // conjugate of the upper one
+      for( j = 0 ; j < n ; ++j ){
+        for( i = 0 ; i <= j ; ++i ){
+          if( na[i] | na[j] ){
+            c[ (int64_t)j * n + i ].r = c[ (int64_t)j * n + i ].i = NA_REAL;
+          }else{
+            c[ (int64_t)j * n + i ].r /= ( s[i] * s[j] );
+            c[ (int64_t)j * n + i ].i /= ( s[i] * s[j] );
+          }
+          c[ (int64_t)i * n + j ].r = c[ (int64_t)j * n + i ].r;
+          c[ (int64_t)i * n + j ].i = -c[ (int64_t)j * n + i ].i;
+        }
+      }
+
+    }else{
+
+      // Squared row norms of the upper triangular U^-1
+      for( i = 0 ; i < n ; ++i ){
+        c[i].r = 0.0;
+        c[i].i = 0.0;
+      }
+      for( j = 0 ; j < n ; ++j ){
+        for( i = 0 ; i <= j ; ++i ){
+          c[i].r += a[ (int64_t)j * n + i ].r * a[ (int64_t)j * n + i ].r + a[ (int64_t)j * n + i ].i * a[ (int64_t)j * n + i ].i;
+        }
+      }
+      for( i = 0 ; i < n ; ++i ){
+        if( na[i] ){
+          c[i].r = c[i].i = NA_REAL;
+        }else{
+          c[i].r /= ( s[i] * s[i] );
+        }
+      }
+
+    }
+  }
+
+  SET_VECTOR_ELT( ans , 0 , sol );
+  SET_VECTOR_ELT( ans , 1 , cov );
+
+  // Set the name attributes
+  PROTECT( names = allocVector( STRSXP , 2 ));
+  SET_STRING_ELT( names , 0 , mkChar( cnames[0] ) );
+  SET_STRING_ELT( names , 1 , mkChar( cnames[1] ) );
+  setAttrib( ans , R_NamesSymbol , names);
+
+  UNPROTECT(4);
+
+  return(ans);
+
+}
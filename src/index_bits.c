@@ -0,0 +1,71 @@
+// file:index_bits.c
+// (c) 2010- University of Oulu, Finland
+// Written by Ilkka Virtanen <ilkka.i.virtanen@oulu.fi>
+// Licensed under FreeBSD license.
+
+#include "LPI.h"
+
+/*
+  Pack a logical index vector into 64-bit words.
+
+  Bit ( k % 64 ) of word k / 64 is set if id[k] is non-zero.
+  Bits beyond the end of the index vector are zero.
+
+  Arguments:
+   id    Integer index vector
+   nd    Length of id
+   bits  Output vector of ( nd + 63 ) / 64 words
+
+*/
+
+void index_bits_pack( const int * id , const int64_t nd , uint64_t * bits )
+{
+  int64_t nw = INDEX_BITS_NWORD( nd );
+  int64_t k;
+  int64_t i;
+  int64_t n;
+  uint64_t w;
+
+  for( i = 0 ; i < nw ; ++i ){
+    n = nd - i * 64;
+    if( n > 64 ) n = 64;
+    w = 0;
+    for( k = 0 ; k < n ; ++k ){
+      w |= (uint64_t)( id[ i * 64 + k ] != 0 ) << k;
+    }
+    bits[i] = w;
+  }
+}
+
+/*
+  Bit-packed copy of a logical index vector. The packed
+  vector can be given to lagged_products and range_ambiguity
+  in place of the logical one.
+
+  Arguments:
+   idata  Logical index vector
+   ndata  Number of points to pack
+
+  Returns:
+   ibits  A raw vector of ( ndata + 63 ) / 64 words
+          of 64 bits each
+
+*/
+
+SEXP index_bits( SEXP idata , SEXP ndata )
+{
+  int64_t nd = *INTEGER(ndata);
+  SEXP ibits;
+
+  if( nd > LENGTH(idata) ) nd = LENGTH(idata);
+  if( nd < 0 ) nd = 0;
+
+  PROTECT( ibits = allocVector( RAWSXP , INDEX_BITS_NWORD( nd ) * sizeof(uint64_t) ) );
+
+  index_bits_pack( LOGICAL(idata) , nd , (uint64_t*)RAW(ibits) );
+
+  UNPROTECT(1);
+
+  return(ibits);
+
+}
@@ -123,12 +123,142 @@ SEXP lagged_products_alloc( SEXP cdata1 , SEXP cdata2 , SEXP idata1 , SEXP idata
 
 
 
+/*
+  Lagged products of samples k0, ..., k1-1.
+
+  The index vectors are either integer vectors id1 and id2,
+  or, if b1 and b2 are not NULL, bit-packed vectors. Packed
+  index vectors are processed in blocks of 64 samples.
+  Blocks without any usable products are only cleared in
+  idp, and blocks in which all products are usable are
+  calculated without inspecting the individual bits.
+
+  If rd1 and rd2 are not NULL, the lagged products of
+  the power values are calculated for variance estimation
+  in the same loop. They are calculated at all points.
+
+  If pulses is not NULL, the runs of non-zero products are
+  added to the pulse list of amb_pulses_add while the index
+  vector is still in cache.
+
+  Arguments:
+   cd1   Complex signal samples
+   cd2   Complex signal samples
+   id1   Index vector of cd1
+   id2   Index vector of cd2
+   b1    Packed index vector of cd1, or NULL
+   nw1   Number of words in b1
+   b2    Packed index vector of cd2, or NULL
+   nw2   Number of words in b2
+   cdp   Output vector for the lagged products
+   cdpf  Single precision output vector, used instead
+         of cdp if not NULL
+   idp   Output index vector for the lagged products
+   rd1   Power values of cd1, or NULL
+   rd2   Power values of cd2, or NULL
+   prd   Output vector for the power products
+   k0    First sample
+   k1    Last sample + 1
+   l     Lag
+   pulses Pulse list of the products, or NULL
+
+*/
+
+void lagged_products_range( const Rcomplex * cd1 , const Rcomplex * cd2 , const int * id1 , const int * id2 , const uint64_t * b1 , const int64_t nw1 , const uint64_t * b2 , const int64_t nw2 , Rcomplex * cdp , float * cdpf , int * idp , const double * rd1 , const double * rd2 , double * prd , const int k0 , const int k1 , const int l , int * pulses )
+{
+  int kb;
+  int k;
+  int n;
+  uint64_t w;
+
+  // Integer index vectors
+  if( ( b1 == NULL ) | ( b2 == NULL ) ){
+    for( k = k0 ; k < k1 ; ++k ){
+
+      // The logical vector
+      idp[k] = (id1[k] * id2[k+ l]);
+
+      // Power product for the variance
+      if( rd1 ) prd[k] = rd1[k] * rd2[k+ l];
+
+      // Multiply the actual data points only
+      //  if the logical vector is set
+      if(idp[k]){
+        complex_store( cdp , cdpf , k ,
+                       cd1[k].r * cd2[k+ l].r + cd1[k].i * cd2[k+ l].i ,
+                       cd1[k].r * cd2[k+ l].i - cd1[k].i * cd2[k+ l].r );
+      }
+    }
+    if( pulses ) amb_pulses_add( idp , k0 , k1 , pulses );
+    return;
+  }
+
+  // Bit-packed index vectors
+  for( kb = k0 ; kb < k1 ; kb += 64 ){
+
+    // Products that can be calculated in this block
+    n = ( k1 - kb ) < 64 ? ( k1 - kb ) : 64;
+    w = index_bits_word( b1 , nw1 , kb ) & index_bits_word( b2 , nw2 , kb + l );
+    if( n < 64 ) w &= ( (uint64_t)1 << n ) - 1;
+
+    // Power products for the variances
+    if( rd1 ){
+      for( k = kb ; k < ( kb + n ) ; ++k ) prd[k] = rd1[k] * rd2[k+ l];
+    }
+
+    if( w == 0 ){
+      // Nothing to calculate
+      for( k = kb ; k < ( kb + n ) ; ++k ) idp[k] = 0;
+
+    }else if( w == ~(uint64_t)0 ){
+      // All products are usable
+      for( k = kb ; k < ( kb + 64 ) ; ++k ){
+        idp[k] = 1;
+        complex_store( cdp , cdpf , k ,
+                       cd1[k].r * cd2[k+ l].r + cd1[k].i * cd2[k+ l].i ,
+                       cd1[k].r * cd2[k+ l].i - cd1[k].i * cd2[k+ l].r );
+      }
+
+    }else{
+      for( k = kb ; k < ( kb + n ) ; ++k ){
+        idp[k] = (int)( ( w >> ( k - kb ) ) & 1 );
+        if(idp[k]){
+          complex_store( cdp , cdpf , k ,
+                         cd1[k].r * cd2[k+ l].r + cd1[k].i * cd2[k+ l].i ,
+                         cd1[k].r * cd2[k+ l].i - cd1[k].i * cd2[k+ l].r );
+        }
+      }
+    }
+
+    // Pulses of this block
+    if( pulses && w ) amb_pulses_add( idp , kb , kb + n , pulses );
+  }
+
+}
+
+
+
 /*
   Calculate lagged products of a signal
   and its complex conjugate. 
 
   This function overwrites existing data vectors
 
+  The index vectors may be given either as logical
+  vectors or as raw vectors packed with index_bits.
+  With packed vectors, 64 samples are inspected at a
+  time, blocks without usable products are skipped, and
+  idatap is set to 1 at usable points.
+
+  If cdatap is a raw vector, the products are stored in
+  single precision as interleaved real and imaginary parts.
+
+  If the power values rdata1 and rdata2 are given, the
+  variances are written to vardata in the same pass.
+
+  If pamb is given, the products are a range ambiguity
+  function and its pulse list is formed in the same pass.
+
   Arguments:
    cdata1  ndata1 vector of complex signal samples
    cdata2  ndata2 vector of complex signal samples
@@ -136,26 +266,38 @@ SEXP lagged_products_alloc( SEXP cdata1 , SEXP cdata2 , SEXP idata1 , SEXP idata
            RX sample positions
    idata2  ndata2 integer vector of usable
            RX sample positions
-   cdatap  complex vector for the lagged products
+   rdata1  ndata1 vector of real power values, or NULL
+           if variances are not needed
+   rdata2  ndata2 vector of real power values, or NULL
+   cdatap  complex vector for the lagged products, or a
+           raw vector of 8 bytes per product
    idatap  integer vector for the lagged product indices
+   vardata real vector for the variances, not used if
+           rdata1 is NULL
    ndata1  Number of samples in cdata1 and idata1
    ndata2  Number of samples in cdata2 and idata2
    lag     Lag
+   pamb    Integer vector for the pulse list of
+           amb_pulses_add, at least ndata1 + 2 values,
+           or NULL
 
   Returns:
    success 1 if processing was succesful, 0 otherwise
   
 */
 
-SEXP lagged_products( SEXP cdata1 , SEXP cdata2 , SEXP idata1 , SEXP idata2 , SEXP cdatap ,\
-		      SEXP idatap , SEXP ndata1 , SEXP ndata2 , SEXP lag )
+SEXP lagged_products( SEXP cdata1 , SEXP cdata2 , SEXP idata1 , SEXP idata2 , SEXP rdata1 , SEXP rdata2 ,\
+		      SEXP cdatap , SEXP idatap , SEXP vardata , SEXP ndata1 , SEXP ndata2 , SEXP lag , SEXP pamb )
 {
   Rcomplex *cd1      =  COMPLEX(cdata1);
   Rcomplex *cd2      =  COMPLEX(cdata2);
-  int      *id1      =  LOGICAL(idata1);
-  int      *id2      =  LOGICAL(idata2);
-  Rcomplex *cdp      =  COMPLEX(cdatap);
+  Rcomplex *cdp      =  NULL;
+  float    *cdpf     =  NULL;
   int      *idp      =  LOGICAL(idatap);
+  double   *rd1      =  NULL;
+  double   *rd2      =  NULL;
+  double   *prd      =  NULL;
+  int      *pl       =  NULL;
   int       nd1      = *INTEGER(ndata1);
   int       nd2      = *INTEGER(ndata2);
   int       l        = *INTEGER(lag)   ;
@@ -176,18 +318,31 @@ SEXP lagged_products( SEXP cdata1 , SEXP cdata2 , SEXP idata1 , SEXP idata2 , SE
   isuccess = LOGICAL( success );
   *isuccess = 1;
 
-  // The actual lagged product calculation
-  for( k = 0 ; k < npr ; ++k ){
+  // Single or double precision output
+  if( TYPEOF(cdatap) == RAWSXP ){
+    cdpf = (float*)RAW(cdatap);
+  }else{
+    cdp = COMPLEX(cdatap);
+  }
 
-    // The logical vector
-    idp[k] = (id1[k] * id2[k+ l]);
+  // Power values for the variances
+  if( !isNull(rdata1) ){
+    rd1 = REAL(rdata1);
+    rd2 = REAL(rdata2);
+    prd = REAL(vardata);
+  }
 
-    // Multiply the actual data points only
-    //  if the logical vector is set
-    if(idp[k]){
-      cdp[k].r = cd1[k].r * cd2[k+ l].r + cd1[k].i * cd2[k+ l].i;
-      cdp[k].i = cd1[k].r * cd2[k+ l].i - cd1[k].i * cd2[k+ l].r;
-    }
+  // Empty pulse list
+  if( !isNull(pamb) ){
+    pl = INTEGER(pamb);
+    pl[0] = 0;
+  }
+
+  // Bit-packed or integer index vectors
+  if( ( TYPEOF(idata1) == RAWSXP ) & ( TYPEOF(idata2) == RAWSXP ) ){
+    lagged_products_range( cd1 , cd2 , NULL , NULL , (uint64_t*)RAW(idata1) , LENGTH(idata1) / sizeof(uint64_t) , (uint64_t*)RAW(idata2) , LENGTH(idata2) / sizeof(uint64_t) , cdp , cdpf , idp , rd1 , rd2 , prd , 0 , npr , l , pl );
+  }else{
+    lagged_products_range( cd1 , cd2 , LOGICAL(idata1) , LOGICAL(idata2) , NULL , 0 , NULL , 0 , cdp , cdpf , idp , rd1 , rd2 , prd , 0 , npr , l , pl );
   }
 
   // Set the logical vector to false at
@@ -204,6 +359,153 @@ SEXP lagged_products( SEXP cdata1 , SEXP cdata2 , SEXP idata1 , SEXP idata2 , SE
 
 
 
+/*
+  Lagged products, their index vectors, and optionally
+  the variances for a block of lags in a single sweep.
+
+  The data vectors are processed in blocks of LAGPROD_BLOCK
+  samples, and the products of all lags are calculated from
+  each block before moving to the next one. The samples are
+  thus read from main memory only once for all lags.
+  Each output vector is identical to the output of
+  lagged_products (and lagged_products_r) for its lag,
+  including the pulse lists of range ambiguity functions.
+
+  This function overwrites existing data vectors
+
+  Arguments:
+   cdata1  ndata1 vector of complex signal samples
+   cdata2  ndata2 vector of complex signal samples
+   idata1  ndata1 logical or bit-packed index vector
+   idata2  ndata2 logical or bit-packed index vector
+   rdata1  ndata1 vector of real power values, or NULL
+           if variances are not needed
+   rdata2  ndata2 vector of real power values, or NULL
+   cdatap  A list of complex (or raw single precision)
+           vectors for the lagged products
+   idatap  A list of integer vectors for the lagged
+           product indices
+   vardata A list of real vectors for the variances,
+           not used if rdata1 is NULL
+   ndata1  Number of samples in cdata1 and idata1
+   ndata2  Number of samples in cdata2 and idata2
+   lags    Integer vector of lags, each lag must be
+           shorter than the data vectors
+   pamb    A list of integer vectors for the pulse lists
+           of amb_pulses_add, at least ndata1 + 2 values
+           each, or NULL
+
+  Returns:
+   success 1 if processing was succesful, 0 otherwise
+
+*/
+
+SEXP lagged_products_lags( SEXP cdata1 , SEXP cdata2 , SEXP idata1 , SEXP idata2 , SEXP rdata1 , SEXP rdata2 , SEXP cdatap , SEXP idatap , SEXP vardata , SEXP ndata1 , SEXP ndata2 , SEXP lags , SEXP pamb )
+{
+  const Rcomplex * cd1 = COMPLEX(cdata1);
+  const Rcomplex * cd2 = COMPLEX(cdata2);
+  const int * id1 = NULL;
+  const int * id2 = NULL;
+  const uint64_t * b1 = NULL;
+  const uint64_t * b2 = NULL;
+  int64_t nw1 = 0;
+  int64_t nw2 = 0;
+  const double * rd1 = NULL;
+  const double * rd2 = NULL;
+  const int nd1 = *INTEGER(ndata1);
+  const int nd2 = *INTEGER(ndata2);
+  const int nlags = LENGTH(lags);
+  const int * l = INTEGER(lags);
+  Rcomplex ** cdp;
+  float ** cdpf;
+  int ** idp;
+  double ** prd;
+  int ** pl;
+  int * npr;
+  int nprmax;
+  int kb;
+  int k1;
+  int j;
+  int k;
+  SEXP success;
+
+  PROTECT( success = allocVector( LGLSXP , 1 ) );
+  *LOGICAL(success) = 1;
+
+  // Index vectors
+  if( ( TYPEOF(idata1) == RAWSXP ) & ( TYPEOF(idata2) == RAWSXP ) ){
+    b1 = (uint64_t*)RAW(idata1);
+    b2 = (uint64_t*)RAW(idata2);
+    nw1 = LENGTH(idata1) / sizeof(uint64_t);
+    nw2 = LENGTH(idata2) / sizeof(uint64_t);
+  }else{
+    id1 = LOGICAL(idata1);
+    id2 = LOGICAL(idata2);
+  }
+
+  // Power vectors
+  if( !isNull(rdata1) ){
+    rd1 = REAL(rdata1);
+    rd2 = REAL(rdata2);
+  }
+
+  // Pointers to the output vectors, freed by R at the end of the call
+  cdp  = (Rcomplex**) R_alloc( nlags , sizeof(Rcomplex*) );
+  cdpf = (float**) R_alloc( nlags , sizeof(float*) );
+  idp  = (int**) R_alloc( nlags , sizeof(int*) );
+  prd  = (double**) R_alloc( nlags , sizeof(double*) );
+  pl   = (int**) R_alloc( nlags , sizeof(int*) );
+  npr  = (int*) R_alloc( nlags , sizeof(int) );
+
+  nprmax = 0;
+  for( j = 0 ; j < nlags ; ++j ){
+    cdp[j] = NULL;
+    cdpf[j] = NULL;
+    if( TYPEOF(VECTOR_ELT(cdatap,j)) == RAWSXP ){
+      cdpf[j] = (float*)RAW(VECTOR_ELT(cdatap,j));
+    }else{
+      cdp[j] = COMPLEX(VECTOR_ELT(cdatap,j));
+    }
+    idp[j] = LOGICAL(VECTOR_ELT(idatap,j));
+    prd[j] = rd1 ? REAL(VECTOR_ELT(vardata,j)) : NULL;
+    pl[j] = NULL;
+    if( !isNull(pamb) ){
+      pl[j] = INTEGER(VECTOR_ELT(pamb,j));
+      pl[j][0] = 0;
+    }
+
+    // Output data length will be minimum of the
+    //  two input data lengths, minus the time-lag
+    npr[j] = nd1 - l[j];
+    if( nd1 > nd2 ) npr[j] = nd2 - l[j];
+    if( npr[j] > nprmax ) nprmax = npr[j];
+  }
+
+  // All lags from one block of samples at a time
+  for( kb = 0 ; kb < nprmax ; kb += LAGPROD_BLOCK ){
+    for( j = 0 ; j < nlags ; ++j ){
+      k1 = ( kb + LAGPROD_BLOCK ) < npr[j] ? ( kb + LAGPROD_BLOCK ) : npr[j];
+      if( k1 <= kb ) continue;
+      lagged_products_range( cd1 , cd2 , id1 , id2 , b1 , nw1 , b2 , nw2 , cdp[j] , cdpf[j] , idp[j] , rd1 , rd2 , prd[j] , kb , k1 , l[j] , pl[j] );
+    }
+  }
+
+  // Set the logical vectors to false at
+  // points where they cannot be calculated
+  for( j = 0 ; j < nlags ; ++j ){
+    for( k = 0 ; k < l[j] ; ++k ){
+      idp[j][npr[j]+k] = 0;
+    }
+  }
+
+  UNPROTECT(1);
+
+  return(success);
+
+}
+
+
+
 /*
   Real-valued lagged products for variance estimation.
 
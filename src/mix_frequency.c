@@ -96,12 +96,12 @@ SEXP mix_frequency( SEXP cdata , SEXP ndata , SEXP frequency)
   int *nd = INTEGER(ndata);
   double *fr = REAL(frequency);
   register uint64_t k, nc;
-  double arg;
+  uint64_t kb, nb;
   Rcomplex ctmp;
   // Temporary variables
   int ncycle;
-  double tmpprod;
-  double idiff;
+  double ncor[MIX_NCO_BLOCK];
+  double ncoi[MIX_NCO_BLOCK];
   double *coefr;
   double *coefi;
   // For the return value
@@ -113,16 +113,8 @@ SEXP mix_frequency( SEXP cdata , SEXP ndata , SEXP frequency)
   isuccess = LOGICAL(success);
   *isuccess = 1;
 
-  // The multiplicand will be cyclic, find the cycle length
-  ncycle = *nd;
-  for( k = 1 ; k < *nd ; ++k){
-    tmpprod = *fr * (double)(k);
-    idiff = tmpprod - (double)((int)(tmpprod));
-    if( fabs(idiff) <= FLT_MIN ){
-      ncycle = k;
-      break;
-    }
-  }
+  // Tabulate the cyclic coefficients
+  ncycle = mix_frequency_coefs( *fr , *nd , &coefr , &coefi );
 
   // If the cycle length is one, the mixing would not change anything
   if( ncycle == 1 ){
@@ -130,15 +122,22 @@ SEXP mix_frequency( SEXP cdata , SEXP ndata , SEXP frequency)
     return(success);
   }
 
-  // Tabulate the cyclic coefficients.
-  // This usually saves time as radar engineers tend to
-  // select nice numerical values for the frequencies
-  coefr = (double*) R_Calloc( ncycle , double );
-  coefi = (double*) R_Calloc( ncycle , double );
-  for( k = 0 ; k < ncycle ; ++k ){
-    arg      = 2.0 * M_PI * *fr * (double)(k);
-    coefr[k] = cos(arg);
-    coefi[k] = sin(arg);
+  // Long cycles, the coefficients are generated
+  // in blocks with the oscillator
+  if( ncycle == 0 ){
+    for( kb = 0 ; kb < *nd ; kb += MIX_NCO_BLOCK ){
+      nb = ( ( *nd - kb ) < MIX_NCO_BLOCK ) ? ( *nd - kb ) : MIX_NCO_BLOCK;
+      mix_frequency_nco( *fr , kb , nb , ncor , ncoi );
+#pragma GCC ivdep
+      for( k = 0 ; k < nb ; ++k ){
+        ctmp.r = cd[kb+k].r;
+        ctmp.i = cd[kb+k].i;
+        cd[kb+k].r = ctmp.r * ncor[k] - ctmp.i * ncoi[k];
+        cd[kb+k].i = ctmp.i * ncor[k] + ctmp.r * ncoi[k];
+      }
+    }
+    UNPROTECT(1);
+    return(success);
   }
 
   // Actual mixing
@@ -165,3 +164,122 @@ SEXP mix_frequency( SEXP cdata , SEXP ndata , SEXP frequency)
   
 }
 
+
+
+
+/*
+  Tabulate the mixing coefficients exp(2i*pi*frequency*k)
+  over one cycle of the multiplicand.
+
+  The tables are allocated with R_Calloc only if the cycle
+  length is larger than one, the caller must Free them.
+  If the cycle is longer than MIX_TABLE_MAX, no tables are
+  allocated and zero is returned. The coefficients must
+  then be generated with mix_frequency_nco.
+
+  Arguments:
+   fr         The mixing frequency
+   nd         Number of samples to be mixed, the
+              longest possible cycle length
+   coefr      Pointer to the real part table
+   coefi      Pointer to the imaginary part table
+
+  Returns:
+   ncycle     The cycle length, 1 if the mixing would
+              not change anything, 0 if the cycle is too
+              long to be tabulated
+*/
+int mix_frequency_coefs( const double fr , const int nd , double ** coefr , double ** coefi )
+{
+  uint64_t k;
+  int ncycle;
+  double arg;
+  double tmpprod;
+  double idiff;
+
+  *coefr = NULL;
+  *coefi = NULL;
+
+  // The multiplicand will be cyclic, find the cycle length.
+  // Cycles longer than MIX_TABLE_MAX are not tabulated,
+  // mix_frequency_nco is used instead
+  ncycle = nd;
+  for( k = 1 ; k < nd ; ++k){
+    if( k > MIX_TABLE_MAX ) return(0);
+    tmpprod = fr * (double)(k);
+    idiff = tmpprod - (double)((int)(tmpprod));
+    if( fabs(idiff) <= FLT_MIN ){
+      ncycle = k;
+      break;
+    }
+  }
+
+  // If the cycle length is one, the mixing would not change anything
+  if( ncycle <= 1 ) return(1);
+
+  // Tabulate the cyclic coefficients.
+  // This usually saves time as radar engineers tend to
+  // select nice numerical values for the frequencies
+  *coefr = (double*) R_Calloc( ncycle , double );
+  *coefi = (double*) R_Calloc( ncycle , double );
+  for( k = 0 ; k < ncycle ; ++k ){
+    arg         = 2.0 * M_PI * fr * (double)(k);
+    (*coefr)[k] = cos(arg);
+    (*coefi)[k] = sin(arg);
+  }
+
+  return(ncycle);
+
+}
+
+/*
+  Numerically controlled oscillator for frequency mixing.
+  Generates the coefficients exp(2i*pi*frequency*k) for
+  k = k0, ..., k0 + n - 1 without tables.
+
+  The first MIX_NCO_LANES coefficients are calculated
+  exactly, and the rest with the recurrence
+  c[k] = c[k-MIX_NCO_LANES] * exp(2i*pi*frequency*MIX_NCO_LANES),
+  which is vectorized over the lanes. The phase is thus
+  re-normalised at the beginning of each call, and n
+  should not be much larger than MIX_NCO_BLOCK to keep the
+  rounding errors small.
+
+  Arguments:
+   fr         The mixing frequency
+   k0         Index of the first coefficient
+   n          Number of coefficients
+   cr         n real parts of the coefficients
+   ci         n imaginary parts of the coefficients
+
+*/
+void mix_frequency_nco( const double fr , const int64_t k0 , const int64_t n , double * restrict cr , double * restrict ci )
+{
+  int64_t k;
+  double arg;
+  double sr;
+  double si;
+
+  // Exact phases in the first lanes, the integer part of
+  // fr * k is removed before the multiplication with 2*pi
+  for( k = 0 ; ( k < MIX_NCO_LANES ) & ( k < n ) ; ++k ){
+    arg   = fr * (double)( k0 + k );
+    arg   = 2.0 * M_PI * ( arg - floor( arg ) );
+    cr[k] = cos(arg);
+    ci[k] = sin(arg);
+  }
+
+  // Phase step of one lane
+  arg = fr * (double)MIX_NCO_LANES;
+  arg = 2.0 * M_PI * ( arg - floor( arg ) );
+  sr  = cos(arg);
+  si  = sin(arg);
+
+  // The recurrence
+#pragma GCC ivdep
+  for( k = MIX_NCO_LANES ; k < n ; ++k ){
+    cr[k] = cr[k-MIX_NCO_LANES] * sr - ci[k-MIX_NCO_LANES] * si;
+    ci[k] = ci[k-MIX_NCO_LANES] * sr + cr[k-MIX_NCO_LANES] * si;
+  }
+
+}
@@ -7,10 +7,18 @@
 
 /*
   Frequency mixing, index adjustments,
-  and filtering in a single function
+  and filtering in a single function.
+
+  The data are processed in a single pass with
+  prepare_stream, and the output vectors are
+  allocated directly at the decimated length.
+  The removed sample ranges are skipped while
+  the data are read.
 
   Arguments:
-   cdata     Complex voltage data vector
+   cdata     Complex voltage data vector, or a raw vector of
+             interleaved 16-bit real and imaginary parts
+             (native byte order, length 4*ndata)
    idata     Integer vector of usable data indices
    ndata     Data vector length
    frequency Frequency offset
@@ -21,6 +29,11 @@
    nfirst    Decimation start index
    ipartial  Logical, are partial matches of
              idata with the filter accepted?
+   trimstart Integer vector of the first samples (counted
+             from 0) of ranges to remove before the
+             processing, in increasing order, or NULL
+   trimlen   Integer vector of the lengths of the ranges
+             to remove, or NULL
 
   Returns:
    ans       A list with elements
@@ -33,7 +46,7 @@
  */
 
 
-SEXP prepare_data( SEXP cdata , SEXP idata , SEXP ndata , SEXP frequency, SEXP shifts , SEXP nup , SEXP nfilter , SEXP nfirst , SEXP nfirstfrac , SEXP ipartial )		  
+SEXP prepare_data( SEXP cdata , SEXP idata , SEXP ndata , SEXP frequency, SEXP shifts , SEXP nup , SEXP nfilter , SEXP nfirst , SEXP nfirstfrac , SEXP ipartial , SEXP trimstart , SEXP trimlen )
 {
   SEXP ans;
   SEXP cdata_new;
@@ -42,83 +55,69 @@ SEXP prepare_data( SEXP cdata , SEXP idata , SEXP ndata , SEXP frequency, SEXP s
   SEXP s;
   SEXP names;
   char *cnames[4] = {"cdata","idata","ndata","success"};
-  Rcomplex * restrict cnew;
-  Rcomplex * restrict cold;
-  int * restrict inew;
-  int * restrict iold;
-  uint64_t k;
-  PROTECT_INDEX cpind=0;
-  PROTECT_INDEX ipind=0;
-
-
+  int64_t nd = *INTEGER(ndata);
+  const int nu = *INTEGER(nup);
+  const int nf = *INTEGER(nfilter);
+  const int ns = *INTEGER(nfirst);
+  const int nsf = *INTEGER(nfirstfrac);
+  int ncycle;
+  double *coefr;
+  double *coefi;
+  int64_t nout;
+  int64_t l;
+  int64_t * kpos;
+  int64_t * off;
+  int ncuts = 0;
+  prepare_cuts cuts;
 
   // Output list ans[[1]] = cdata ans[[2]] = pdata ,
   // ans[[3]] = idata , ans[[4]] = ndata , ans[[5]] = success
   PROTECT( ans = allocVector( VECSXP , 5 ) );
 
+  // Removed sample ranges and the data vector
+  // length after the removals
+  if( !isNull(trimstart) ) ncuts = LENGTH(trimstart);
+  kpos = (int64_t *) R_alloc( ncuts + 1 , sizeof(int64_t) );
+  off = (int64_t *) R_alloc( ncuts + 1 , sizeof(int64_t) );
+  cuts.n = prepare_stream_cuts( nd , ncuts ? INTEGER(trimstart) : NULL , ncuts ? INTEGER(trimlen) : NULL , ncuts , kpos , off , &nd );
+  cuts.kpos = kpos;
+  cuts.off = off;
+  cuts.m = 0;
+
+  // Length of the filtered and decimated vectors
+  nout = prepare_stream_length( nd , nu , nf , ns , nsf , 0 );
+
   // Allocate the new complex vector
-  PROTECT_WITH_INDEX( cdata_new = allocVector( CPLXSXP , *(INTEGER(ndata)) ) , &cpind );
+  PROTECT( cdata_new = allocVector( CPLXSXP , nout ) );
 
   // Allocate the new logical vector
-  PROTECT_WITH_INDEX( idata_new = allocVector( LGLSXP , *(INTEGER(ndata)) ) , &ipind );
+  PROTECT( idata_new = allocVector( LGLSXP , nout ) );
 
   // Allocate the new ndata variable
   PROTECT( ndata_new = allocVector( INTSXP , 1 ) );
 
-  // A pointer to the new cdata vector
-  cnew = COMPLEX( cdata_new );
-
-  // A pointer to the old cdata vector
-  cold = COMPLEX( cdata );
-
-  // A pointer to the new idata vector
-  inew = LOGICAL( idata_new );
-
-  // A pointer to the old idata vector
-  iold = LOGICAL( idata );
-
-  // Copy data from old cdata to new cdata
-  for( k = 0 ; k < *(INTEGER(ndata)) ; ++k ){
-    cnew[k].r = cold[k].r;
-    cnew[k].i = cold[k].i;
-  }
-
-  // Copy data from old idata to new idata
-  for( k = 0 ; k < *(INTEGER(ndata)) ; ++k ){
-    inew[k] = iold[k];
-  }
-
-  // Use the same pointers to copy old ndata to new ndata
-  inew = INTEGER( ndata_new);
-  iold = INTEGER( ndata );
-  *inew = *iold;
-
   // The  success logical
   PROTECT( s = allocVector( LGLSXP , 1 ) );
 
-  // Frequency mixing
-  s = mix_frequency( cdata_new , ndata_new , frequency );
-
-  // Index adjustments
-  s = index_adjust( idata_new , ndata_new , shifts );
-
-  // Filtering
-  s = resample( cdata_new , idata_new , ndata_new , nup , nfilter , nfirst , nfirstfrac , ipartial );
-
-  // Set cdata_new to zero at all points where idata_new==0
-  inew = LOGICAL( idata_new );
-  for( k = 0 ; k < *INTEGER(ndata_new) ; ++k ){
-    if( inew[k] == 0 ){
-      cnew[k].r = .0;
-      cnew[k].i = .0;
-    }
+  // Tabulate the mixing coefficients
+  ncycle = mix_frequency_coefs( *REAL(frequency) , nd , &coefr , &coefi );
+
+  // Frequency mixing, index adjustments, filtering,
+  // and zeroing of samples with idata==0 in a single pass
+  l = prepare_stream( ( TYPEOF(cdata) == RAWSXP ) ? NULL : COMPLEX(cdata) ,
+                      ( TYPEOF(cdata) == RAWSXP ) ? (int16_t*)RAW(cdata) : NULL ,
+                      LOGICAL(idata) , nd , ( cuts.n > 0 ) ? &cuts : NULL , *REAL(frequency) , ncycle , coefr , coefi ,
+                      INTEGER(shifts)[0] , INTEGER(shifts)[1] ,
+                      nu , nf , ns , nsf , *LOGICAL(ipartial) , NULL , 0 ,
+                      COMPLEX(cdata_new) , LOGICAL(idata_new) );
+
+  if( ncycle > 1 ){
+    Free(coefr);
+    Free(coefi);
   }
 
-  // Reallocate the vectors to match with the new data length
-  SET_LENGTH( cdata_new , *INTEGER(ndata_new) );
-  REPROTECT( cdata_new , cpind );
-  SET_LENGTH( idata_new , *INTEGER(ndata_new) );
-  REPROTECT( idata_new , ipind );
+  *INTEGER(ndata_new) = (int)l;
+  *LOGICAL(s) = ( l == nout );
 
   // Collect the data into the return list
   SET_VECTOR_ELT( ans , 0 , cdata_new );
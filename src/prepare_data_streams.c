@@ -0,0 +1,209 @@
+// file:prepare_data_streams.c
+// (c) 2010- University of Oulu, Finland
+// Written by Ilkka Virtanen <ilkka.i.virtanen@oulu.fi>
+// Licensed under FreeBSD license.
+
+#include "LPI.h"
+#include <pthread.h>
+
+// Everything that prepare_stream needs for one data vector
+typedef struct {
+  const Rcomplex * cd;
+  const int16_t * cd16;
+  const int * id;
+  int64_t nd;
+  prepare_cuts cuts;
+  double fr;
+  int ncycle;
+  double * coefr;
+  double * coefi;
+  int sh0;
+  int sh1;
+  int nu;
+  int nf;
+  int ns;
+  int nsf;
+  int ipar;
+  const double * taps;
+  int ntaps;
+  Rcomplex * co;
+  int * io;
+  int64_t l;
+} prepare_stream_args;
+
+static void * prepare_stream_thread( void * arg )
+{
+  prepare_stream_args * a = (prepare_stream_args *) arg;
+
+  a->l = prepare_stream( a->cd , a->cd16 , a->id , a->nd , ( a->cuts.n > 0 ) ? &(a->cuts) : NULL , a->fr , a->ncycle , a->coefr , a->coefi , a->sh0 , a->sh1 , a->nu , a->nf , a->ns , a->nsf , a->ipar , a->taps , a->ntaps , a->co , a->io );
+
+  return(NULL);
+}
+
+/*
+  Frequency mixing, index adjustments, and filtering
+  of several data vectors in parallel threads.
+
+  Identical to calling prepare_data separately for each
+  data vector. All R vectors are allocated in the calling
+  thread, the worker threads run prepare_stream only.
+
+  Samples can be removed from the data vectors before
+  the processing, e.g. to make each IPP a multiple of the
+  filter length. The removed ranges are given as lists of
+  start indices and lengths, and they are skipped while
+  the worker threads read the data vectors.
+
+  Arguments:
+   cdata      A list of complex data vectors, or raw vectors
+              of interleaved 16-bit samples
+   idata      A list of logical index vectors
+   ndata      Integer vector of data vector lengths
+   frequency  Numeric vector of frequency offsets
+   shifts     A list of 2-vectors of index shifts
+   nup        Integer vector of upsampling factors
+   nfilter    Integer vector of filter lengths
+   nfirst     Integer vector of decimation start indices
+   nfirstfrac Integer vector of start points within the
+              boxcar filters in upsampled units
+   ipartial   Logical, are partial matches of idata
+              with the filter accepted?
+   taps       A list of numeric vectors of FIR filter taps
+              on the upsampled grid, boxcar filters are
+              used for empty vectors
+   trimstart  A list of integer vectors of the first samples
+              (counted from 0) of the ranges to remove, in
+              increasing order
+   trimlen    A list of integer vectors of the lengths
+              of the ranges to remove
+
+  Returns:
+   ans       A list with one element per data vector, each
+             element is a list identical to the output
+             of prepare_data
+
+*/
+
+SEXP prepare_data_streams( SEXP cdata , SEXP idata , SEXP ndata , SEXP frequency , SEXP shifts , SEXP nup , SEXP nfilter , SEXP nfirst , SEXP nfirstfrac , SEXP ipartial , SEXP taps , SEXP trimstart , SEXP trimlen )
+{
+  SEXP ans;
+  SEXP stream;
+  SEXP cdata_new;
+  SEXP idata_new;
+  SEXP ndata_new;
+  SEXP s;
+  SEXP names;
+  char *cnames[4] = {"cdata","idata","ndata","success"};
+  const int nstream = LENGTH(cdata);
+  prepare_stream_args * args;
+  pthread_t * threads;
+  int * started;
+  int64_t * nout;
+  int64_t * kpos;
+  int64_t * off;
+  int ncuts;
+  int k;
+
+  // Work space, freed by R at the end of the call
+  args = (prepare_stream_args *) R_alloc( nstream , sizeof(prepare_stream_args) );
+  threads = (pthread_t *) R_alloc( nstream , sizeof(pthread_t) );
+  started = (int *) R_alloc( nstream , sizeof(int) );
+  nout = (int64_t *) R_alloc( nstream , sizeof(int64_t) );
+
+  // One list per data vector
+  PROTECT( ans = allocVector( VECSXP , nstream ) );
+
+  // Allocate all vectors before starting the threads
+  for( k = 0 ; k < nstream ; ++k ){
+
+    PROTECT( stream = allocVector( VECSXP , 5 ) );
+    SET_VECTOR_ELT( ans , k , stream );
+    UNPROTECT(1);
+
+    args[k].nu  = INTEGER(nup)[k];
+    args[k].nf  = INTEGER(nfilter)[k];
+    args[k].ns  = INTEGER(nfirst)[k];
+    args[k].nsf = INTEGER(nfirstfrac)[k];
+    args[k].sh0 = INTEGER(VECTOR_ELT(shifts,k))[0];
+    args[k].sh1 = INTEGER(VECTOR_ELT(shifts,k))[1];
+    args[k].ipar = *LOGICAL(ipartial);
+    args[k].taps = REAL(VECTOR_ELT(taps,k));
+    args[k].ntaps = LENGTH(VECTOR_ELT(taps,k));
+
+    // Removed sample ranges and the data vector
+    // length after the removals
+    ncuts = LENGTH(VECTOR_ELT(trimstart,k));
+    kpos = (int64_t *) R_alloc( ncuts + 1 , sizeof(int64_t) );
+    off = (int64_t *) R_alloc( ncuts + 1 , sizeof(int64_t) );
+    args[k].cuts.n = prepare_stream_cuts( INTEGER(ndata)[k] , INTEGER(VECTOR_ELT(trimstart,k)) , INTEGER(VECTOR_ELT(trimlen,k)) , ncuts , kpos , off , &(args[k].nd) );
+    args[k].cuts.kpos = kpos;
+    args[k].cuts.off = off;
+    args[k].cuts.m = 0;
+
+    // Length of the filtered and decimated vectors
+    nout[k] = prepare_stream_length( args[k].nd , args[k].nu , args[k].nf , args[k].ns , args[k].nsf , args[k].ntaps );
+
+    cdata_new = allocVector( CPLXSXP , nout[k] );
+    SET_VECTOR_ELT( stream , 0 , cdata_new );
+    idata_new = allocVector( LGLSXP , nout[k] );
+    SET_VECTOR_ELT( stream , 1 , idata_new );
+    ndata_new = allocVector( INTSXP , 1 );
+    SET_VECTOR_ELT( stream , 2 , ndata_new );
+    s = allocVector( LGLSXP , 1 );
+    SET_VECTOR_ELT( stream , 3 , s );
+
+    // Set the name attributes
+    PROTECT( names = allocVector( STRSXP , 4 ));
+    SET_STRING_ELT( names , 0 , mkChar( cnames[0] ) );
+    SET_STRING_ELT( names , 1 , mkChar( cnames[1] ) );
+    SET_STRING_ELT( names , 2 , mkChar( cnames[2] ) );
+    SET_STRING_ELT( names , 3 , mkChar( cnames[3] ) );
+    setAttrib( stream , R_NamesSymbol , names);
+    UNPROTECT(1);
+
+    args[k].cd   = ( TYPEOF(VECTOR_ELT(cdata,k)) == RAWSXP ) ? NULL : COMPLEX(VECTOR_ELT(cdata,k));
+    args[k].cd16 = ( TYPEOF(VECTOR_ELT(cdata,k)) == RAWSXP ) ? (int16_t*)RAW(VECTOR_ELT(cdata,k)) : NULL;
+    args[k].id   = LOGICAL(VECTOR_ELT(idata,k));
+    args[k].co   = COMPLEX(cdata_new);
+    args[k].io   = LOGICAL(idata_new);
+
+  }
+
+  // Tabulate the mixing coefficients
+  for( k = 0 ; k < nstream ; ++k ){
+    args[k].fr = REAL(frequency)[k];
+    args[k].ncycle = mix_frequency_coefs( REAL(frequency)[k] , args[k].nd , &(args[k].coefr) , &(args[k].coefi) );
+  }
+
+  // Start threads for all but the first data vector, the first
+  // one is handled in this thread. If a thread cannot be
+  // started, the data vector is handled after the first one.
+  for( k = 1 ; k < nstream ; ++k ){
+    started[k] = ( pthread_create( &threads[k] , NULL , prepare_stream_thread , &args[k] ) == 0 );
+  }
+  if( nstream > 0 ) prepare_stream_thread( &args[0] );
+  for( k = 1 ; k < nstream ; ++k ){
+    if( started[k] ){
+      pthread_join( threads[k] , NULL );
+    }else{
+      prepare_stream_thread( &args[k] );
+    }
+  }
+
+  // Data lengths, success flags and memory cleanup
+  for( k = 0 ; k < nstream ; ++k ){
+    stream = VECTOR_ELT( ans , k );
+    if( args[k].l < 0 ) args[k].l = 0;
+    *INTEGER(VECTOR_ELT(stream,2)) = (int)args[k].l;
+    *LOGICAL(VECTOR_ELT(stream,3)) = ( args[k].l == nout[k] );
+    if( args[k].ncycle > 1 ){
+      Free(args[k].coefr);
+      Free(args[k].coefi);
+    }
+  }
+
+  UNPROTECT(1);
+
+  return(ans);
+
+}
@@ -0,0 +1,600 @@
+// file:prepare_stream.c
+// (c) 2010- University of Oulu, Finland
+// Written by Ilkka Virtanen <ilkka.i.virtanen@oulu.fi>
+// Licensed under FreeBSD license.
+
+#include "LPI.h"
+
+/*
+  Frequency mixing, index adjustments, filtering and
+  masking of one data vector in a single pass.
+
+  The result is identical to copying the data and calling
+  mix_frequency, index_adjust and resample, and then
+  setting the samples with zero index to zero, but the
+  input vectors are read only once and only the decimated
+  vectors are written. The adjusted index vector is
+  produced in blocks of PREPARE_BLOCK samples, so that
+  the index adjustments and filtering operate on data
+  that is in cache.
+
+  Samples can be removed from the data before the
+  processing. The removed ranges are skipped while the
+  input is read, and the function operates on the
+  remaining samples as if they were a contiguous vector.
+
+  The function does not call R, the caller must allocate
+  the output vectors with at least prepare_stream_length
+  elements and tabulate the mixing coefficients with
+  mix_frequency_coefs. Long mixing cycles are generated
+  block by block with mix_frequency_nco.
+
+  Arguments:
+   cd       nd complex data samples, or NULL if cd16 is used
+   cd16     2*nd interleaved 16-bit real and imaginary
+            parts, or NULL if cd is used
+   id       nd index values
+   nd       Data vector length, the number of remaining
+            samples if cuts is not NULL
+   cuts     Removed sample ranges from prepare_stream_cuts,
+            NULL if all samples are used
+   fr       The mixing frequency
+   ncycle   Cycle length of the mixing coefficients,
+            1 if no mixing is needed, 0 if the
+            coefficients are generated with
+            mix_frequency_nco
+   coefr    Real parts of the mixing coefficients
+   coefi    Imaginary parts of the mixing coefficients
+   sh0      Index shift at rising edges
+   sh1      Index shift at falling edges
+   nu       Upsampling factor
+   nf       Filter length on upsampled data
+   ns       Decimation start index
+   nsf      Start point within the boxcar filter
+            in upsampled units
+   ipar     0 if partial matches with filter should not
+            be accepted in the index vector
+   taps     FIR filter taps on the upsampled grid
+   ntaps    Number of filter taps, 0 for the boxcar filter
+   co       Output complex data vector
+   io       Output index vector
+
+  Returns:
+   l        Number of samples written to co and io,
+            -1 if memory allocation failed
+
+*/
+
+int64_t prepare_stream( const Rcomplex * restrict cd , const int16_t * restrict cd16 , const int * restrict id , const int64_t nd , prepare_cuts * cuts , const double fr , const int ncycle , const double * coefr , const double * coefi , const int sh0 , const int sh1 , const int nu , const int nf , const int ns , const int nsf , const int ipar , const double * taps , const int ntaps , Rcomplex * restrict co , int * restrict io )
+{
+  int64_t i, j, k, l, kb, nb, nc;
+  int64_t lasttrue;
+  int64_t ncut;
+  int64_t nwin;
+  double frac=0.;
+  Rcomplex tmpsum;
+  Rcomplex ctmp;
+  int tmpi[2];
+  int ib[PREPARE_BLOCK];
+  double ncor[PREPARE_BLOCK];
+  double ncoi[PREPARE_BLOCK];
+  const double * cr = ( ncycle > 1 ) ? coefr : ncor;
+  const double * ci = ( ncycle > 1 ) ? coefi : ncoi;
+
+  // Filters other than the boxcar
+  if( ntaps > 0 ){
+    return( prepare_stream_fir( cd , cd16 , id , nd , cuts , fr , ncycle , coefr , coefi , sh0 , sh1 , nu , nf , ns , nsf , ipar , taps , ntaps , co , io ) );
+  }
+
+  // The last true index in the original index vector,
+  // the adjusted vector is zeroed after lasttrue + sh1
+  lasttrue = 0;
+  for( k = ( nd - 1 ) ; k >= 0 ; --k ){
+    if( id[ prepare_cuts_raw( cuts , k ) ] ){
+      lasttrue = k;
+      break;
+    }
+  }
+  ncut = lasttrue + sh1 + 1;
+
+  // The counters have the same meaning as in resample
+  i = (int64_t)ns * nu;
+  j = nsf + nu - 1;
+  k = ns;
+  l = 0;
+  tmpsum.r = 0.;
+  tmpsum.i = 0.;
+  tmpi[0] = 1;
+  tmpi[1] = 0;
+
+  // The first block of adjusted indices
+  kb = k;
+  nb = 0;
+  nwin = 0;
+  index_adjust_block( id , nd , cuts , sh0 , sh1 - sh0 , ncut , kb , ib , &nwin , 1 );
+  if( ncycle == 0 ) mix_frequency_nco( fr , kb , PREPARE_BLOCK , ncor , ncoi );
+
+  // Position in the mixing coefficient tables
+  nc = ( ncycle > 1 ) ? ( k % ncycle ) : 0;
+  if( ncycle == 1 ){
+    ncor[0] = 1.;
+    ncoi[0] = 0.;
+  }
+
+  while( ( ( i + nf ) / nu ) <= nd ){
+    while( j < nf ){
+      if( ( k - kb ) >= PREPARE_BLOCK ){
+        kb += PREPARE_BLOCK;
+        index_adjust_block( id , nd , cuts , sh0 , sh1 - sh0 , ncut , kb , ib , &nwin , 0 );
+        if( ncycle == 0 ) mix_frequency_nco( fr , kb , PREPARE_BLOCK , ncor , ncoi );
+      }
+      nb = k - kb;
+      prepare_stream_sample( cd , cd16 , prepare_cuts_raw( cuts , k ) , ncycle != 1 , cr[ ncycle ? nc : nb ] , ci[ ncycle ? nc : nb ] , &ctmp );
+      tmpsum.r += ctmp.r;
+      tmpsum.i += ctmp.i;
+      tmpi[0] *= ib[nb];
+      tmpi[1] += ib[nb];
+      j += nu;
+      ++k;
+      if( ++nc >= ncycle ) nc = 0;
+    }
+
+    // frac is either 0 or 1, see resample
+    frac = 0.;
+    if( ( j - nf + 1 ) ==  nu ) frac = 1.;
+
+    if( k < nd ){
+      if( ( k - kb ) >= PREPARE_BLOCK ){
+        kb += PREPARE_BLOCK;
+        index_adjust_block( id , nd , cuts , sh0 , sh1 - sh0 , ncut , kb , ib , &nwin , 0 );
+        if( ncycle == 0 ) mix_frequency_nco( fr , kb , PREPARE_BLOCK , ncor , ncoi );
+      }
+      nb = k - kb;
+      prepare_stream_sample( cd , cd16 , prepare_cuts_raw( cuts , k ) , ncycle != 1 , cr[ ncycle ? nc : nb ] , ci[ ncycle ? nc : nb ] , &ctmp );
+      tmpsum.r += ( 1. - frac )*ctmp.r;
+      tmpsum.i += ( 1. - frac )*ctmp.i;
+      if( frac < .99999 ) tmpi[0] *= ib[nb];
+      if( frac < .99999 ) tmpi[1] += ib[nb];
+      // Write the decimated sample, masked if
+      // the index is zero
+      io[l] = ipar ? tmpi[1] : tmpi[0];
+      co[l].r = io[l] ? tmpsum.r : .0;
+      co[l].i = io[l] ? tmpsum.i : .0;
+      tmpsum.r = frac*ctmp.r;
+      tmpsum.i = frac*ctmp.i;
+      tmpi[0] = ( frac < .00001 ) ? 1 : ib[nb];
+      tmpi[1] = ( frac < .00001 ) ? 0 : ib[nb];
+      j -= nf;
+      j += nu;
+      ++l;
+    }
+
+    i += nf;
+    ++k;
+    if( ++nc >= ncycle ) nc = 0;
+  }
+
+  // If we were exactly at end of data frac is unity, we will still get one more sample
+  if( k == ( nd + 1 ) ){
+    if( frac > .9999999 ){
+      io[l] = ipar ? tmpi[1] : tmpi[0];
+      co[l].r = io[l] ? tmpsum.r : .0;
+      co[l].i = io[l] ? tmpsum.i : .0;
+      ++l;
+    }
+  }
+
+  return(l);
+
+}
+
+/*
+  Length of the data vectors produced by prepare_stream.
+  Only the counters of the resampling are run, so that the
+  output vectors can be allocated before the filtering.
+
+  Arguments:
+   nd       Data vector length
+   nu       Upsampling factor
+   nf       Filter length on upsampled data
+   ns       Decimation start index
+   nsf      Start point within the boxcar filter
+            in upsampled units
+   ntaps    Number of FIR filter taps, 0 for
+            the boxcar filter
+
+  Returns:
+   l        Number of decimated samples
+
+*/
+
+int64_t prepare_stream_length( const int64_t nd , const int nu , const int nf , const int ns , const int nsf , const int ntaps )
+{
+  int64_t i, j, k, l, m;
+  int frac = 0;
+
+  // FIR filters, all taps must be within the data
+  if( ntaps > 0 ){
+    i = (int64_t)ns * nu - nsf;
+    m = nd * nu - ntaps - i;
+    return( ( m >= 0 ) ? ( m / nf + 1 ) : 0 );
+  }
+
+  i = (int64_t)ns * nu;
+  j = nsf + nu - 1;
+  k = ns;
+  l = 0;
+
+  while( ( ( i + nf ) / nu ) <= nd ){
+    // Number of samples added in the inner loop
+    if( j < nf ){
+      m = ( nf - j + nu - 1 ) / nu;
+      j += m * nu;
+      k += m;
+    }
+    frac = ( ( j - nf + 1 ) == nu );
+    if( k < nd ){
+      j += nu - nf;
+      ++l;
+    }
+    i += nf;
+    ++k;
+  }
+
+  if( ( k == ( nd + 1 ) ) & frac ) ++l;
+
+  return(l);
+
+}
+
+/*
+  One frequency mixed data sample
+
+  Arguments:
+   cd       Complex data samples, or NULL
+   cd16     Interleaved 16-bit samples, or NULL
+   k        Sample index
+   mix      0 if no mixing is needed
+   cr       Real part of the mixing coefficient
+   ci       Imaginary part of the mixing coefficient
+   ctmp     The mixed sample
+
+*/
+void prepare_stream_sample( const Rcomplex * restrict cd , const int16_t * restrict cd16 , const int64_t k , const int mix , const double cr , const double ci , Rcomplex * ctmp )
+{
+  double re, im;
+
+  if( cd16 ){
+    re = (double)cd16[ 2 * k ];
+    im = (double)cd16[ 2 * k + 1 ];
+  }else{
+    re = cd[k].r;
+    im = cd[k].i;
+  }
+
+  if( mix ){
+    ctmp->r = re * cr - im * ci;
+    ctmp->i = im * cr + re * ci;
+  }else{
+    ctmp->r = re;
+    ctmp->i = im;
+  }
+}
+
+/*
+  Index adjustments of one block of PREPARE_BLOCK samples,
+  identical to index_adjust.
+
+  The rising edge shift is a shift of the whole vector.
+  A negative falling edge shift removes all points that
+  are not followed by at least |sh1| nonzero points, and
+  a positive shift sets to one all points that have a
+  nonzero point within the sh1 preceding points. Both
+  are evaluated by counting the nonzero points in a
+  window that slides over the shifted vector, the count
+  is carried from one block to the next.
+
+  Arguments:
+   id       nd index values before adjustments
+   nd       Data vector length
+   cuts     Removed sample ranges, or NULL
+   sh0      Index shift at rising edges
+   sh1      Falling edge shift after the rising edge
+            shift, i.e. shifts[1] - shifts[0]
+   ncut     Points from ncut onwards are set to zero
+   kb       First point of the block
+   ib       PREPARE_BLOCK adjusted index values
+   nwin     Number of nonzero points in the sliding window
+   first    1 if this is the first block, the
+            window count is initialised
+
+*/
+void index_adjust_block( const int * restrict id , const int64_t nd , prepare_cuts * cuts , const int sh0 , const int sh1 , const int64_t ncut , const int64_t kb , int * restrict ib , int64_t * nwin , const int first )
+{
+  int64_t k, m;
+  int64_t w = ( sh1 < 0 ) ? -sh1 : sh1;
+  int64_t cnt = *nwin;
+  int v;
+
+  // Nonzero points within the window of the first point
+  if( first ){
+    cnt = 0;
+    for( m = 0 ; m <= w ; ++m ){
+      if( sh1 < 0 ){
+        cnt += index_adjust_nonzero( id , nd , cuts , sh0 , kb + m , 0 );
+      }else if( sh1 > 0 ){
+        cnt += index_adjust_nonzero( id , nd , cuts , sh0 , kb - m , 1 );
+      }
+    }
+  }
+
+  for( k = kb ; k < ( kb + PREPARE_BLOCK ) ; ++k ){
+
+    // Slide the window to the current point
+    if( ( k > kb ) | !first ){
+      if( sh1 < 0 ){
+        cnt += index_adjust_nonzero( id , nd , cuts , sh0 , k + w , 0 ) - index_adjust_nonzero( id , nd , cuts , sh0 , k - 1 , 0 );
+      }else if( sh1 > 0 ){
+        cnt += index_adjust_nonzero( id , nd , cuts , sh0 , k , 1 ) - index_adjust_nonzero( id , nd , cuts , sh0 , k - w - 1 , 1 );
+      }
+    }
+
+    // Points beyond the data vector are zero
+    if( ( k >= nd ) | ( k >= ncut ) | ( k < 0 ) ){
+      ib[k-kb] = 0;
+      continue;
+    }
+
+    // Rising edge shift
+    v = id[ prepare_cuts_raw( cuts , ( k < sh0 ) ? 0 : ( ( ( k - sh0 ) >= nd ) ? ( nd - 1 ) : ( k - sh0 ) ) ) ];
+
+    // Falling edge shift
+    if( sh1 < 0 ){
+      if( cnt <= w ) v = 0;
+    }else if( sh1 > 0 ){
+      v = ( cnt > 0 );
+    }
+
+    ib[k-kb] = v;
+  }
+
+  *nwin = cnt;
+
+}
+
+/*
+  Is point k of the rising edge shifted index vector
+  nonzero? Points outside of the vector are set to
+  'outside'.
+*/
+int index_adjust_nonzero( const int * restrict id , const int64_t nd , prepare_cuts * cuts , const int sh0 , const int64_t k , const int outside )
+{
+  int64_t m;
+  if( ( k < 0 ) | ( k >= nd ) ) return(outside);
+  m = k - sh0;
+  if( m < 0 ) m = 0;
+  if( m >= nd ) m = nd - 1;
+  return( id[ prepare_cuts_raw( cuts , m ) ] != 0 );
+}
+
+/*
+  Frequency mixing, index adjustments, FIR filtering and
+  masking of one data vector, see prepare_stream.
+
+  The mixed samples and adjusted indices are produced in
+  blocks of PREPARE_BLOCK samples to a buffer that also
+  holds the end of the previous block, and all output
+  samples whose filters are within the buffer are then
+  calculated with resample_fir. Output sample l starts
+  at point ns * nu - nsf + l * nf on the upsampled grid.
+
+  Returns:
+   l        Number of samples written to co and io,
+            -1 if memory allocation failed
+
+*/
+
+int64_t prepare_stream_fir( const Rcomplex * restrict cd , const int16_t * restrict cd16 , const int * restrict id , const int64_t nd , prepare_cuts * cuts , const double fr , const int ncycle , const double * coefr , const double * coefi , const int sh0 , const int sh1 , const int nu , const int nf , const int ns , const int nsf , const int ipar , const double * taps , const int ntaps , Rcomplex * restrict co , int * restrict io )
+{
+  int64_t i0, k, kb, bs, bl, l0, l1, nout, nacc, nc, t, nkeep;
+  int64_t lasttrue;
+  int64_t ncut;
+  int64_t nwin;
+  int ntab;
+  int first;
+  int ib[PREPARE_BLOCK];
+  double ncor[PREPARE_BLOCK];
+  double ncoi[PREPARE_BLOCK];
+  double * g;
+  int * gnz;
+  double * xr;
+  double * xi;
+  int * xid;
+  double * accr;
+  double * acci;
+  int * accp;
+  int * accs;
+  Rcomplex ctmp;
+
+  // Number of output samples
+  nout = prepare_stream_length( nd , nu , nf , ns , nsf , ntaps );
+  if( nout <= 0 ) return(0);
+
+  // The polyphase tables
+  ntab = resample_fir_ntab( ntaps , nu );
+
+  // Start point of the first filter on the upsampled grid,
+  // and the first original sample that it covers
+  i0 = (int64_t)ns * nu - nsf;
+  kb = ( i0 >= 0 ) ? ( i0 / nu ) : -( ( nu - 1 - i0 ) / nu );
+
+  // Maximum number of output samples per block
+  nacc = ( ( PREPARE_BLOCK + ntab ) * (int64_t)nu ) / nf + 2;
+
+  g    = (double*) malloc( (size_t)nu * ntab * sizeof(double) );
+  gnz  = (int*)    malloc( (size_t)nu * ntab * sizeof(int) );
+  xr   = (double*) malloc( (size_t)( PREPARE_BLOCK + ntab ) * sizeof(double) );
+  xi   = (double*) malloc( (size_t)( PREPARE_BLOCK + ntab ) * sizeof(double) );
+  xid  = (int*)    malloc( (size_t)( PREPARE_BLOCK + ntab ) * sizeof(int) );
+  accr = (double*) malloc( (size_t)nacc * sizeof(double) );
+  acci = (double*) malloc( (size_t)nacc * sizeof(double) );
+  accp = (int*)    malloc( (size_t)nacc * sizeof(int) );
+  accs = (int*)    malloc( (size_t)nacc * sizeof(int) );
+
+  if( !g | !gnz | !xr | !xi | !xid | !accr | !acci | !accp | !accs ){
+    l0 = -1;
+  }else{
+
+    resample_fir_tables( taps , ntaps , nu , ntab , g , gnz );
+
+    // The index vector is cut after lasttrue + sh1
+    lasttrue = 0;
+    for( k = ( nd - 1 ) ; k >= 0 ; --k ){
+      if( id[ prepare_cuts_raw( cuts , k ) ] ){
+        lasttrue = k;
+        break;
+      }
+    }
+    ncut = lasttrue + sh1 + 1;
+
+    if( ncycle == 1 ){
+      ncor[0] = 1.;
+      ncoi[0] = 0.;
+    }
+
+    bs = kb;
+    bl = 0;
+    l0 = 0;
+    nwin = 0;
+    first = 1;
+
+    while( l0 < nout ){
+
+      // Mix and adjust the next block of samples
+      index_adjust_block( id , nd , cuts , sh0 , sh1 - sh0 , ncut , kb , ib , &nwin , first );
+      if( ncycle == 0 ) mix_frequency_nco( fr , kb , PREPARE_BLOCK , ncor , ncoi );
+      nc = ( ncycle > 1 ) ? ( ( ( kb % ncycle ) + ncycle ) % ncycle ) : 0;
+      for( t = 0 ; t < PREPARE_BLOCK ; ++t ){
+        k = kb + t;
+        if( ( k >= 0 ) & ( k < nd ) ){
+          prepare_stream_sample( cd , cd16 , prepare_cuts_raw( cuts , k ) , ncycle != 1 , ( ncycle > 1 ) ? coefr[nc] : ncor[ ncycle ? 0 : t ] , ( ncycle > 1 ) ? coefi[nc] : ncoi[ ncycle ? 0 : t ] , &ctmp );
+        }else{
+          ctmp.r = 0.;
+          ctmp.i = 0.;
+        }
+        xr[ bl + t ]  = ctmp.r;
+        xi[ bl + t ]  = ctmp.i;
+        xid[ bl + t ] = ib[t];
+        if( ++nc >= ncycle ) nc = 0;
+      }
+      bl += PREPARE_BLOCK;
+      kb += PREPARE_BLOCK;
+      first = 0;
+
+      // All outputs whose filters are in the buffer
+      l1 = l0;
+      while( l1 < nout ){
+        k = i0 + l1 * nf;
+        k = ( k >= 0 ) ? ( k / nu ) : -( ( nu - 1 - k ) / nu );
+        if( ( k + ntab ) > ( bs + bl ) ) break;
+        ++l1;
+      }
+      if( l1 > l0 ){
+        resample_fir( xr , xi , xid , bs , g , gnz , ntab , nu , nf , i0 , l0 , l1 , ipar , accr , acci , accp , accs , co , io );
+      }
+      l0 = l1;
+
+      // Keep the samples needed by the next output
+      k = i0 + l0 * nf;
+      k = ( k >= 0 ) ? ( k / nu ) : -( ( nu - 1 - k ) / nu );
+      nkeep = bs + bl - k;
+      if( nkeep < 0 ) nkeep = 0;
+      if( nkeep > bl ) nkeep = bl;
+      for( t = 0 ; t < nkeep ; ++t ){
+        xr[t]  = xr[ bl - nkeep + t ];
+        xi[t]  = xi[ bl - nkeep + t ];
+        xid[t] = xid[ bl - nkeep + t ];
+      }
+      bs += bl - nkeep;
+      bl = nkeep;
+    }
+  }
+
+  free(g);
+  free(gnz);
+  free(xr);
+  free(xi);
+  free(xid);
+  free(accr);
+  free(acci);
+  free(accp);
+  free(accs);
+
+  return(l0);
+
+}
+
+/*
+  Removed sample ranges of a data vector. The samples
+  cstart[n] , ... , cstart[n] + clen[n] - 1 are removed for
+  n = 0 , ... , ncuts - 1 , the ranges must be in increasing
+  order of cstart but they may overlap. The ranges are
+  converted to the positions of the cuts in the remaining
+  data and the numbers of samples removed before them,
+  overlapping and adjacent ranges are merged.
+
+  Arguments:
+   nd       Data vector length
+   cstart   ncuts first samples of the removed ranges
+   clen     ncuts lengths of the removed ranges
+   ncuts    Number of removed ranges
+   kpos     At least ncuts values, first remaining sample
+            after each cut
+   off      At least ncuts + 1 values, number of samples
+            removed before kpos, off[0] = 0
+   nkept    Number of remaining samples
+
+  Returns:
+   n        Number of cuts in kpos
+
+*/
+int prepare_stream_cuts( const int64_t nd , const int * cstart , const int * clen , const int ncuts , int64_t * kpos , int64_t * off , int64_t * nkept )
+{
+  int64_t k, n, c0, c1;
+  int m;
+  int nc;
+
+  // k is the first raw sample not yet handled,
+  // n the number of remaining samples before it
+  k = 0;
+  n = 0;
+  nc = 0;
+  off[0] = 0;
+  for( m = 0 ; m < ncuts ; ++m ){
+
+    c0 = cstart[m];
+    c1 = (int64_t)cstart[m] + clen[m];
+    if( c0 < 0 ) c0 = 0;
+    if( c0 > nd ) c0 = nd;
+    if( c1 > nd ) c1 = nd;
+    if( c1 < c0 ) c1 = c0;
+
+    // Nothing new is removed
+    if( c1 <= k ) continue;
+
+    // The samples before the range remain
+    if( c0 > k ) n += c0 - k;
+    k = c1;
+
+    // A range that starts where the previous one
+    // ended is merged to it
+    if( ( nc == 0 ) || ( kpos[ nc - 1 ] != n ) ) ++nc;
+    kpos[ nc - 1 ] = n;
+    off[nc] = k - n;
+  }
+
+  *nkept = n + nd - k;
+
+  return(nc);
+
+}
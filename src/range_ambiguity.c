@@ -6,54 +6,192 @@
 #include "LPI.h"
 
 /*
-  Range ambiguity function with linear 
+  Interpolation weights of the range ambiguity function.
+
+  The transmitter samples are linearly interpolated to
+  ninterp points between each sample and its neighbours.
+  The interpolated points towards the previous sample are
+  a_i * x[k-1] + b_i * x[k], and those towards the next
+  sample are b_i * x[k] + a_i * x[k+1], with
+  a_i = i / ( 2 * ninterp ) and b_i = 1 - a_i,
+  i = 0, ..., ninterp-1. Because the weights are real,
+  the sum of products of the interpolated points depends
+  only on the sums of a_i^2, a_i*b_i, and b_i^2.
+
+  Arguments:
+   ninterp  Number of interpolated points on each side
+   w        Output vector of length 3, sums of a_i^2,
+            a_i*b_i, and b_i^2 divided by the number
+            of interpolated points 2*ninterp
+
+*/
+
+void range_ambiguity_weights( const int ninterp , double * w )
+{
+  int i;
+  double a;
+
+  w[0] = w[1] = w[2] = .0;
+  for( i = 0 ; i < ninterp ; ++i ){
+    a = (double)i / (double)( 2 * ninterp );
+    w[0] += a * a;
+    w[1] += a * ( 1. - a );
+    w[2] += ( 1. - a ) * ( 1. - a );
+  }
+  for( i = 0 ; i < 3 ; ++i ) w[i] /= (double)( 2 * ninterp );
+}
+
+/*
+  Interpolated range ambiguity function values of
+  samples k0, ..., k1-1.
+
+  All values are calculated, the caller takes care
+  of the index vector. The loop does not branch and
+  is vectorized by the compiler.
+
+  Arguments:
+   cd1   First complex transmitter samples
+   cd2   Second complex transmitter samples
+   k0    First sample, k0 >= 2
+   k1    Last sample + 1
+   l     Lag
+   w     Interpolation weights from range_ambiguity_weights
+   cdp   Complex range ambiguity function
+   cdpf  Single precision range ambiguity function,
+         used instead of cdp if not NULL
+
+*/
+
+static void range_ambiguity_block( const Rcomplex * restrict cd1 , const Rcomplex * restrict cd2 , const int k0 , const int k1 , const int l , const double * w , Rcomplex * restrict cdp , float * restrict cdpf )
+{
+  const Rcomplex * restrict c2 = cd2 + l;
+  const double waa = w[0];
+  const double wab = w[1];
+  const double wbb = w[2];
+  double sr;
+  double si;
+  int k;
+
+  for( k = k0 ; k < k1 ; ++k ){
+
+    // Products of the current samples, both sides
+    sr = 2. * wbb * ( cd1[k].r * c2[k].r + cd1[k].i * c2[k].i );
+    si = 2. * wbb * ( cd1[k].r * c2[k].i - cd1[k].i * c2[k].r );
+
+    // Products with the previous and the next samples
+    sr += waa * ( cd1[k-1].r * c2[k-1].r + cd1[k-1].i * c2[k-1].i
+                  + cd1[k+1].r * c2[k+1].r + cd1[k+1].i * c2[k+1].i );
+    si += waa * ( cd1[k-1].r * c2[k-1].i - cd1[k-1].i * c2[k-1].r
+                  + cd1[k+1].r * c2[k+1].i - cd1[k+1].i * c2[k+1].r );
+
+    // Cross products of the current and neighbouring samples
+    sr += wab * ( cd1[k-1].r * c2[k].r + cd1[k-1].i * c2[k].i
+                  + cd1[k].r * c2[k-1].r + cd1[k].i * c2[k-1].i
+                  + cd1[k].r * c2[k+1].r + cd1[k].i * c2[k+1].i
+                  + cd1[k+1].r * c2[k].r + cd1[k+1].i * c2[k].i );
+    si += wab * ( cd1[k-1].r * c2[k].i - cd1[k-1].i * c2[k].r
+                  + cd1[k].r * c2[k-1].i - cd1[k].i * c2[k-1].r
+                  + cd1[k].r * c2[k+1].i - cd1[k].i * c2[k+1].r
+                  + cd1[k+1].r * c2[k].i - cd1[k+1].i * c2[k].r );
+
+    if( cdpf ){
+      cdpf[ 2 * k ] = (float)sr;
+      cdpf[ 2 * k + 1 ] = (float)si;
+    }else{
+      cdp[k].r = sr;
+      cdp[k].i = si;
+    }
+  }
+}
+
+/*
+  Interpolated range ambiguity function value of sample
+  k < 2. The interpolation towards the previous sample is
+  not used for these samples.
+*/
+
+static void range_ambiguity_first( const Rcomplex * cd1 , const Rcomplex * cd2 , const int k , const int l , const double * w , Rcomplex * cdp , float * cdpf )
+{
+  const Rcomplex * c2 = cd2 + l;
+  double sr;
+  double si;
+
+  sr = w[2] * ( cd1[k].r * c2[k].r + cd1[k].i * c2[k].i )
+    + w[1] * ( cd1[k].r * c2[k+1].r + cd1[k].i * c2[k+1].i + cd1[k+1].r * c2[k].r + cd1[k+1].i * c2[k].i )
+    + w[0] * ( cd1[k+1].r * c2[k+1].r + cd1[k+1].i * c2[k+1].i );
+  si = w[2] * ( cd1[k].r * c2[k].i - cd1[k].i * c2[k].r )
+    + w[1] * ( cd1[k].r * c2[k+1].i - cd1[k].i * c2[k+1].r + cd1[k+1].r * c2[k].i - cd1[k+1].i * c2[k].r )
+    + w[0] * ( cd1[k+1].r * c2[k+1].i - cd1[k+1].i * c2[k+1].r );
+
+  complex_store( cdp , cdpf , k , sr , si );
+}
+
+/*
+  Range ambiguity function with linear
   interpolation of TX data
 
+  The index vectors may be given either as logical
+  vectors or as raw vectors packed with index_bits.
+  The samples are processed in blocks of 64, blocks
+  without usable values are skipped, and all values of
+  the other blocks are calculated in a vectorized loop.
+  With packed vectors, idatap is set to 1 at usable points.
+
+  If cdatap is a raw vector, the function is stored in
+  single precision as interleaved real and imaginary parts.
+
+  The pulse list of the function is formed from the index
+  vector of each block of 64 samples that contains pulses.
+
   Arguments:
    cdata1  First complex transmitter samples
    cdata2  Second complex transmitter samples
    idata1  First transmitter sample indices
    idata2  Seconds transmitter sample indices
-   cdatap  Complex range ambiguity function
+   cdatap  Complex range ambiguity function, or a raw
+           vector of 8 bytes per point
    idatap  Range ambiguity index vector
    ndata1  Length of vectors cdata1 and idata1
    ndata2  Length of vectors cdata2 and idata2
    lag     Lag
+   ninterp Number of interpolated points on each side of
+           a sample, AMB_N_INTERP is used if ninterp < 1
+   pamb    Integer vector for the pulse list of
+           amb_pulses_add, at least ndata1 + 2 values
 
   Returns:
    success 1 if all processing was successful, 0 otherwise
 
 */
 
-SEXP range_ambiguity( SEXP cdata1 , SEXP cdata2 , SEXP idata1 , SEXP idata2 , SEXP cdatap , SEXP idatap , SEXP ndata1 , SEXP ndata2 , SEXP lag )
+SEXP range_ambiguity( SEXP cdata1 , SEXP cdata2 , SEXP idata1 , SEXP idata2 , SEXP cdatap , SEXP idatap , SEXP ndata1 , SEXP ndata2 , SEXP lag , SEXP ninterp , SEXP pamb )
 {
   Rcomplex *cd1 = COMPLEX(cdata1);
   Rcomplex *cd2 = COMPLEX(cdata2);
-  int *id1 = LOGICAL(idata1);
-  int *id2 = LOGICAL(idata2);
-  Rcomplex *cdp = COMPLEX(cdatap);
+  int *id1 = NULL;
+  int *id2 = NULL;
+  uint64_t *b1 = NULL;
+  uint64_t *b2 = NULL;
+  int64_t nw1 = 0;
+  int64_t nw2 = 0;
+  Rcomplex *cdp = NULL;
+  float *cdpf = NULL;
   int *idp =  LOGICAL(idatap);
+  int *pl = INTEGER(pamb);
   int nd1 = *INTEGER(ndata1);
   int nd2 = *INTEGER(ndata2);
   int l = *INTEGER(lag);
+  int ni = *INTEGER(ninterp);
   SEXP success;
   int *isuccess;
   int k = 0;
+  int k0;
+  int n;
   int npr;
-  int ninterp = AMB_N_INTERP;
-  int i;
-  double * tmpr1;
-  double * tmpi1;
-  double * tmpr2;
-  double * tmpi2;
-
-  // Allocate temporary vectors for interpolated data
-  tmpr1 = (double*) R_Calloc( 2*ninterp , double );
-  tmpi1 = (double*) R_Calloc( 2*ninterp , double );
-  tmpr2 = (double*) R_Calloc( 2*ninterp , double );
-  tmpi2 = (double*) R_Calloc( 2*ninterp , double );
-
-  // Output data length will be minimum of the 
+  uint64_t wb;
+  double w[3];
+
+  // Output data length will be minimum of the
   // two input data lengths, minus the lag
   npr = nd1 - l;
   if( nd1 > nd2 ) npr = nd2 - l;
@@ -65,49 +203,70 @@ SEXP range_ambiguity( SEXP cdata1 , SEXP cdata2 , SEXP idata1 , SEXP idata2 , SE
   isuccess = LOGICAL( success );
   *isuccess = 1;
 
-  // The actual lagged product calculation
-  for( k = 0 ; k < npr ; ++k ){
+  // Interpolation weights
+  if( ni < 1 ) ni = AMB_N_INTERP;
+  range_ambiguity_weights( ni , w );
+
+  // Single or double precision output
+  if( TYPEOF(cdatap) == RAWSXP ){
+    cdpf = (float*)RAW(cdatap);
+  }else{
+    cdp = COMPLEX(cdatap);
+  }
+
+  // Bit-packed or integer index vectors
+  if( ( TYPEOF(idata1) == RAWSXP ) & ( TYPEOF(idata2) == RAWSXP ) ){
+    b1 = (uint64_t*)RAW(idata1);
+    b2 = (uint64_t*)RAW(idata2);
+    nw1 = LENGTH(idata1) / sizeof(uint64_t);
+    nw2 = LENGTH(idata2) / sizeof(uint64_t);
+  }else{
+    id1 = LOGICAL(idata1);
+    id2 = LOGICAL(idata2);
+  }
+
+  // Empty pulse list
+  pl[0] = 0;
+
+  // 64 samples at a time
+  for( k0 = 0 ; k0 < npr ; k0 += 64 ){
+
+    n = ( npr - k0 ) < 64 ? ( npr - k0 ) : 64;
+
     // The index vector
-    idp[k] = (id1[k] * id2[k+ l]);
-    // Multiply data values only if the index vector was set
-    if(idp[k]){
-      // Initialize the temporary vectors to zero
-      for( i = 0 ; i < ( 2 * ninterp ) ; ++i ){
-	tmpr1[i] = .0;
-	tmpi1[i] = .0;
-	tmpr2[i] = .0;
-	tmpi2[i] = .0;
-      }
-      // Linear interpolation towards the previous data point
-      if( k > 1 ){
-	for( i = 0 ; i < ninterp ; ++i ){
-	  tmpr1[i] = cd1[k-1].r + ( cd1[k].r - cd1[k-1].r ) * ( 1. - (double)i / (double)( 2 * ninterp ) );
-	  tmpi1[i] = cd1[k-1].i + ( cd1[k].i - cd1[k-1].i ) * ( 1. - (double)i / (double)( 2 * ninterp ) );
-	  tmpr2[i] = cd2[k-1+l].r + ( cd2[k+l].r - cd2[k-1+l].r ) * ( 1. - (double)i / (double)( 2 * ninterp ) );
-	  tmpi2[i] = cd2[k-1+l].i + ( cd2[k+l].i - cd2[k-1+l].i ) * ( 1. - (double)i / (double)( 2 * ninterp ) );
-	}
+    wb = 0;
+    if( b1 ){
+      wb = index_bits_word( b1 , nw1 , k0 ) & index_bits_word( b2 , nw2 , k0 + l );
+      if( n < 64 ) wb &= ( (uint64_t)1 << n ) - 1;
+      for( k = 0 ; k < n ; ++k ) idp[ k0 + k ] = (int)( ( wb >> k ) & 1 );
+    }else{
+      for( k = 0 ; k < n ; ++k ){
+        idp[ k0 + k ] = (id1[ k0 + k ] * id2[ k0 + k + l ]);
+        wb |= (uint64_t)( idp[ k0 + k ] != 0 ) << k;
       }
-      // Linear interpolation towards the next data point
-      if( k < npr ){
-        for( i = 0 ; i < ninterp ; ++i ){
-          tmpr1[i+ninterp] = cd1[k].r + ( cd1[k+1].r - cd1[k].r ) * ( (double)i / (double)( 2 * ninterp ) );
-          tmpi1[i+ninterp] = cd1[k].i + ( cd1[k+1].i - cd1[k].i ) * ( (double)i / (double)( 2 * ninterp ) );
-          tmpr2[i+ninterp] = cd2[k+l].r + ( cd2[k+1+l].r - cd2[k+l].r ) * ( (double)i / (double)( 2 * ninterp ) );
-          tmpi2[i+ninterp] = cd2[k+l].i + ( cd2[k+1+l].i - cd2[k+l].i ) * ( (double)i / (double)( 2 * ninterp ) );
-        }
-      }
-      // Initialize the final data value to zero
-      cdp[k].r = .0;
-      cdp[k].i = .0;
-      // Add products of the interpolated data
-      for( i = 0 ; i < ( 2 * ninterp ) ; ++i ){
-        cdp[k].r += tmpr1[i] * tmpr2[i] + tmpi1[i] * tmpi2[i];
-        cdp[k].i += tmpr1[i] * tmpi2[i] - tmpi1[i] * tmpr2[i];
-      }
-      // Divide with number of summed values
-      cdp[k].r /= (double)(2*ninterp);
-      cdp[k].i /= (double)(2*ninterp);
     }
+
+    // Nothing to calculate in this block
+    if( wb == 0 ) continue;
+
+    // Pulses of this block
+    amb_pulses_add( idp , k0 , k0 + n , pl );
+
+    // Data values, the first two samples are
+    // interpolated towards the next sample only
+    for( k = k0 ; k < 2 && k < ( k0 + n ) ; ++k ){
+      if( idp[k] ) range_ambiguity_first( cd1 , cd2 , k , l , w , cdp , cdpf );
+    }
+    // The last sample is calculated only if it is used,
+    // in order not to read beyond the data vectors
+    // unnecessarily
+    if( ( k0 + n ) == npr ){
+      if( k < ( npr - 1 ) ) range_ambiguity_block( cd1 , cd2 , k , npr - 1 , l , w , cdp , cdpf );
+      if( ( npr > 2 ) && idp[ npr - 1 ] ) range_ambiguity_block( cd1 , cd2 , npr - 1 , npr , l , w , cdp , cdpf );
+    }else{
+      range_ambiguity_block( cd1 , cd2 , k , k0 + n , l , w , cdp , cdpf );
+    }
+
   }
 
   // Set l index values from the beginning to false
@@ -115,16 +274,8 @@ SEXP range_ambiguity( SEXP cdata1 , SEXP cdata2 , SEXP idata1 , SEXP idata2 , SE
     idp[npr+k] = 0;
   }
 
-  // Free the temporary vectors
-  Free(tmpr1);
-  Free(tmpi1);
-  Free(tmpr2);
-  Free(tmpi2);
-
   UNPROTECT(1);
 
   return(success);
 
 }
-
-
@@ -4,6 +4,13 @@
 // Licensed under FreeBSD license.
 
 #include "LPI.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Block size (in samples) for files that cannot be memory-mapped
+#define GDF_READ_BLOCK 1048576
 
 /*
   Read IQ data from .gdf files
@@ -79,13 +86,182 @@ SEXP read_gdf_data_R( SEXP ndata , SEXP nfiles , SEXP filepaths, SEXP istart , S
 
 }
 
+/*
+  Read IQ data from .gdf files as 16-bit integers
+
+  Identical to read_gdf_data_R, but the samples are stored
+  as interleaved 16-bit real and imaginary parts in a raw
+  vector (native byte order). This takes one quarter of the
+  memory of the complex vector, and prepare_data widens the
+  samples only when they are filtered and decimated.
+
+  This function allocates new data vectors.
+
+  Arguments:
+   ndata      Total number of data points to read
+   nfiles     Number of data files
+   filepaths  nfiles data file paths
+   istart     nfiles start indices
+   iend       nfiles end indices
+   bigendian  logical, 0 if files are little-endian
+
+  Returns:
+   ans       A list with elements
+              cdata   Raw vector of 16-bit data samples
+              idatar  Lowest bits from real part (PPS)
+              idatai  Lowest bits from imaginary part (TX)
+              ndata   Data vector length
+              success Logical, set if all requested data was read
+
+ */
+
+SEXP read_gdf_data_int16_R( SEXP ndata , SEXP nfiles , SEXP filepaths, SEXP istart , SEXP iend , SEXP bigendian)
+{
+
+  SEXP ans;
+  SEXP cdata;
+  SEXP idatar;
+  SEXP idatai;
+  SEXP s;
+  SEXP names;
+  char *cnames[5] = {"cdata","idatar","idatai","ndata","success"};
+
+  // Output list
+  PROTECT( ans = allocVector( VECSXP , 5 ) ); 
+  // The cdata vector, two 16-bit integers per sample
+  PROTECT( cdata = allocVector( RAWSXP , (R_xlen_t)(*(INTEGER(ndata))) * 4 ) );
+  // The idatar vector
+  PROTECT( idatar = allocVector( LGLSXP , *(INTEGER(ndata)) ) );
+  // The idatai vector
+  PROTECT( idatai = allocVector( LGLSXP , *(INTEGER(ndata)) ) );
+
+  // The actual reading
+  PROTECT( s = read_gdf_data( cdata , idatar , idatai , ndata , nfiles, filepaths, istart , iend , bigendian ) );
+
+  // Collect the data vectors into the list
+  SET_VECTOR_ELT( ans , 0 , cdata  );
+  SET_VECTOR_ELT( ans , 1 , idatar );
+  SET_VECTOR_ELT( ans , 2 , idatai );
+  SET_VECTOR_ELT( ans , 3 , ndata  );
+  SET_VECTOR_ELT( ans , 4 , s      );
+
+  // Set the name attributes
+  PROTECT( names = allocVector( STRSXP , 5 ));
+  SET_STRING_ELT( names , 0 , mkChar( cnames[0] ) );
+  SET_STRING_ELT( names , 1 , mkChar( cnames[1] ) );
+  SET_STRING_ELT( names , 2 , mkChar( cnames[2] ) );
+  SET_STRING_ELT( names , 3 , mkChar( cnames[3] ) );
+  SET_STRING_ELT( names , 4 , mkChar( cnames[4] ) );
+  setAttrib( ans , R_NamesSymbol , names);
+
+  UNPROTECT(6);
+
+  return(ans);
+
+}
+
+/*
+  Decode a block of raw gdf samples
+
+  Each sample is four bytes, 16-bit real part followed by
+  16-bit imaginary part. The byte order is resolved outside
+  of the sample loops so that both loops are branch-free
+  and can be vectorized by the compiler.
+
+  Arguments:
+   src     Raw sample bytes, 4*n bytes
+   cd      n complex output samples
+   idr     n lowest bits of the real parts (PPS)
+   idi     n lowest bits of the imaginary parts (TX)
+   n       Number of samples to decode
+   be      1 if src is big-endian, 0 otherwise
+
+*/
+static void gdf_decode( const uint8_t * restrict src , Rcomplex * restrict cd , int * restrict idr , int * restrict idi , const uint64_t n , const int be )
+{
+  uint64_t k;
+  int16_t ir;
+  int16_t ii;
+
+  if( be ){
+#pragma GCC ivdep
+    for( k = 0 ; k < n ; ++k ){
+      ir = (int16_t)( ( src[4*k] << 8 ) | src[4*k+1] );
+      ii = (int16_t)( ( src[4*k+2] << 8 ) | src[4*k+3] );
+      idr[k] = ir & 0x0001;
+      idi[k] = ii & 0x0001;
+      cd[k].r = (double)( ir & (int16_t)0xfffe );
+      cd[k].i = (double)( ii & (int16_t)0xfffe );
+    }
+  }else{
+#pragma GCC ivdep
+    for( k = 0 ; k < n ; ++k ){
+      ir = (int16_t)( ( src[4*k+1] << 8 ) | src[4*k] );
+      ii = (int16_t)( ( src[4*k+3] << 8 ) | src[4*k+2] );
+      idr[k] = ir & 0x0001;
+      idi[k] = ii & 0x0001;
+      cd[k].r = (double)( ir & (int16_t)0xfffe );
+      cd[k].i = (double)( ii & (int16_t)0xfffe );
+    }
+  }
+}
+
+/*
+  Decode a block of raw gdf samples to interleaved
+  16-bit integers, see gdf_decode.
+
+  Arguments:
+   src     Raw sample bytes, 4*n bytes
+   cd      2*n interleaved real and imaginary parts
+   idr     n lowest bits of the real parts (PPS)
+   idi     n lowest bits of the imaginary parts (TX)
+   n       Number of samples to decode
+   be      1 if src is big-endian, 0 otherwise
+
+*/
+static void gdf_decode_int16( const uint8_t * restrict src , int16_t * restrict cd , int * restrict idr , int * restrict idi , const uint64_t n , const int be )
+{
+  uint64_t k;
+  int16_t ir;
+  int16_t ii;
+
+  if( be ){
+#pragma GCC ivdep
+    for( k = 0 ; k < n ; ++k ){
+      ir = (int16_t)( ( src[4*k] << 8 ) | src[4*k+1] );
+      ii = (int16_t)( ( src[4*k+2] << 8 ) | src[4*k+3] );
+      idr[k] = ir & 0x0001;
+      idi[k] = ii & 0x0001;
+      cd[2*k]   = ir & (int16_t)0xfffe;
+      cd[2*k+1] = ii & (int16_t)0xfffe;
+    }
+  }else{
+#pragma GCC ivdep
+    for( k = 0 ; k < n ; ++k ){
+      ir = (int16_t)( ( src[4*k+1] << 8 ) | src[4*k] );
+      ii = (int16_t)( ( src[4*k+3] << 8 ) | src[4*k+2] );
+      idr[k] = ir & 0x0001;
+      idi[k] = ii & 0x0001;
+      cd[2*k]   = ir & (int16_t)0xfffe;
+      cd[2*k+1] = ii & (int16_t)0xfffe;
+    }
+  }
+}
+
 /*
   Read IQ data from .gdf files
 
-  This function reads the data to pre-allocated vectors
+  This function reads the data to pre-allocated vectors.
+
+  The files are memory-mapped and the samples are decoded
+  directly from the mapped pages, the kernel is advised to
+  read the mapped region sequentially. Files that cannot
+  be mapped are read in blocks of GDF_READ_BLOCK samples.
 
   Arguments:
-   cdata      ndata complex vector for data samples
+   cdata      ndata complex vector for data samples, or a
+              raw vector of length 4*ndata for interleaved
+              16-bit samples
    idatar     ndata integer vector for lowest bits
               in real part
    idatai     ndata integer vector for lowest bits
@@ -104,10 +280,10 @@ SEXP read_gdf_data_R( SEXP ndata , SEXP nfiles , SEXP filepaths, SEXP istart , S
 SEXP read_gdf_data( SEXP cdata , SEXP idatar , SEXP idatai , SEXP ndata , SEXP nfiles , SEXP filepaths , SEXP istart , SEXP iend , SEXP bigendian )
 {
   // Pointers to the R variables
-  Rcomplex *cd = COMPLEX(cdata);
+  Rcomplex *cd = ( TYPEOF(cdata) == RAWSXP ) ? NULL : COMPLEX(cdata);
+  int16_t *cd16 = ( TYPEOF(cdata) == RAWSXP ) ? (int16_t*)RAW(cdata) : NULL;
   int *idr = LOGICAL(idatar);
   int *idi = LOGICAL(idatai);
-  int *nd = INTEGER(ndata);
   int *nf = INTEGER(nfiles);
   const char *fpath;
   int *is = INTEGER(istart);
@@ -117,83 +293,128 @@ SEXP read_gdf_data( SEXP cdata , SEXP idatar , SEXP idatai , SEXP ndata , SEXP n
   SEXP success;
   int *isuccess;
   // Counters and other temporary variables
-  register uint64_t k, n, kd;
-  register int16_t ir;
-  register int16_t ii;
+  uint64_t k, kd, nr, nblock;
+  off_t off, pgoff;
+  size_t nbytes, navail, maplen;
+  long pagesize;
+  uint8_t *map;
   uint8_t *rblock;
-  FILE *fp;
-  size_t rr;
+  ssize_t rr;
+  struct stat st;
+  int fd;
 
   // Allocate the return value and initialise it
   PROTECT(success = allocVector(LGLSXP,1));
   isuccess = LOGICAL(success);
   *isuccess = 1;
 
+  // mmap offsets must be multiples of the page size
+  pagesize = sysconf(_SC_PAGESIZE);
+
   // Data point counter
   kd = 0;
 
-  // Allocate memory for the data
-  rblock = (uint8_t*) malloc(*nd*4);
-
-  for( k=0 ; k<(*nf) ; ++k ) {
+  for( k=0 ; k<(*nf) ; ++k ){
 
     // Select the data file from input list
     fpath = CHAR(STRING_ELT(filepaths,k));
 
     // Open the data file for reading
-    fp = fopen( fpath , "r" );
+    fd = open( fpath , O_RDONLY );
 
-    // If the fopen failed set success
+    // If the open failed set success
     // to false and break the read loop
-    if(fp == 0){
+    if( fd < 0 ){
       *isuccess = 0;
       break;
     }
 
-    // Seek for the starting point
-    fseek( fp , (is[k]*4) , SEEK_SET);
+    // Byte range requested from this file
+    off = (off_t)is[k] * 4;
+    nbytes = (size_t)( ie[k] - is[k] + 1 ) * 4;
 
-    // Read data from file number k
-    rr = fread( &(rblock[(kd*4)]) , 1 , ((ie[k]-is[k]+1) * 4) , fp );
+    // Number of bytes actually available
+    navail = 0;
+    if( fstat( fd , &st ) == 0 ){
+      if( st.st_size > off ){
+        navail = (size_t)( st.st_size - off );
+        if( navail > nbytes ) navail = nbytes;
+      }
+    }
 
-    // Success will be set only if every single sample
-    // is successfully read
-    *isuccess = *isuccess && (rr==(ie[k]-is[k]+1)*4);
+    // Map the requested range, starting from
+    // the preceding page boundary
+    map = MAP_FAILED;
+    pgoff = off - ( off % pagesize );
+    maplen = navail + (size_t)( off - pgoff );
+    if( navail > 0 ){
+      map = mmap( NULL , maplen , PROT_READ , MAP_PRIVATE , fd , pgoff );
+    }
 
-    // Close the file
-    fclose(fp);
+    if( map != MAP_FAILED ){
 
-    for( n=is[k] ; n<=ie[k] ; ++n ){
+      // Stream through the pages only once
+      madvise( map , maplen , MADV_SEQUENTIAL );
+      madvise( map , maplen , MADV_WILLNEED );
 
-      // Conversion from 8-bit to 16-bit integers
-      if( be ){ // big endian
-	ir = ( rblock[kd*4] << 8 ) + rblock[kd*4+1];
-	ii = ( rblock[kd*4+2] << 8 ) + rblock[kd*4+3];
-      }else{ // little endian
-	ir = ( rblock[kd*4+1] << 8 ) + rblock[kd*4];
-	ii = ( rblock[kd*4+3] << 8 ) + rblock[kd*4+2];
+      nr = navail / 4;
+      if( cd16 ){
+        gdf_decode_int16( map + ( off - pgoff ) , cd16 + 2 * kd , idr + kd , idi + kd , nr , be );
+      }else{
+        gdf_decode( map + ( off - pgoff ) , cd + kd , idr + kd , idi + kd , nr , be );
       }
-      // Put the lowest bits to the index vectors
-      idr[kd] = ir & 0x0001;
-      idi[kd] = ii & 0x0001;
-
-      // Remove the lowest bits from the complex data vector
-      ir &= 0xfffe;
-      ii &= 0xfffe;
 
-      // Conversion to double floats 
-      // (which are used in Rcomplex data type)
-      cd[kd].r = (double)(ir);
-      cd[kd].i = (double)(ii);
+      munmap( map , maplen );
+
+    }else{
+
+      // Fall back to block-wise reads for
+      // files that could not be mapped
+      nr = 0;
+      rblock = (uint8_t*) malloc( GDF_READ_BLOCK * 4 );
+      if( rblock != NULL ){
+        while( nr < ( nbytes / 4 ) ){
+          nblock = nbytes / 4 - nr;
+          if( nblock > GDF_READ_BLOCK ) nblock = GDF_READ_BLOCK;
+          rr = pread( fd , rblock , nblock * 4 , off + (off_t)( nr * 4 ) );
+          if( rr <= 0 ) break;
+          nblock = (uint64_t)rr / 4;
+          if( cd16 ){
+            gdf_decode_int16( rblock , cd16 + 2 * ( kd + nr ) , idr + kd + nr , idi + kd + nr , nblock , be );
+          }else{
+            gdf_decode( rblock , cd + kd + nr , idr + kd + nr , idi + kd + nr , nblock , be );
+          }
+          nr += nblock;
+          if( (uint64_t)rr < GDF_READ_BLOCK * 4 ) break;
+        }
+        free(rblock);
+      }
+    }
 
-      // Increment the sample counter
-      ++kd;
+    // Close the file
+    close(fd);
 
+    // Success will be set only if every single sample
+    // is successfully read
+    *isuccess = *isuccess && ( nr * 4 == nbytes );
+
+    // Samples that could not be read are set to zero
+    for( ; nr < ( nbytes / 4 ) ; ++nr ){
+      if( cd16 ){
+        cd16[2*(kd+nr)] = 0;
+        cd16[2*(kd+nr)+1] = 0;
+      }else{
+        cd[kd+nr].r = .0;
+        cd[kd+nr].i = .0;
+      }
+      idr[kd+nr] = 0;
+      idi[kd+nr] = 0;
     }
 
+    // Increment the sample counter
+    kd += nbytes / 4;
+
   }
-  // Free memory
-  free(rblock);
 
   // Remove protection from the return value
   UNPROTECT(1);
@@ -203,4 +424,3 @@ SEXP read_gdf_data( SEXP cdata , SEXP idatar , SEXP idatai , SEXP ndata , SEXP n
   return(success);
   
 }
-
@@ -6,27 +6,40 @@
 // R registration of C functions
 
 #include "LPI.h"
-static const R_CallMethodDef callMethods[23] = {
+static const R_CallMethodDef callMethods[36] = {
   { "read_gdf_data_R"       , (DL_FUNC) & read_gdf_data_R       , 6 } , 
+  { "read_gdf_data_int16_R" , (DL_FUNC) & read_gdf_data_int16_R , 6 } , 
   { "mix_frequency_R"       , (DL_FUNC) & mix_frequency_R       , 3 } , 
   { "index_adjust_R"        , (DL_FUNC) & index_adjust_R        , 3 } , 
+  { "index_bits"            , (DL_FUNC) & index_bits            , 2 } ,
   { "lagged_products_alloc" , (DL_FUNC) & lagged_products_alloc , 7 } ,
-  { "lagged_products"       , (DL_FUNC) & lagged_products       , 9 } ,
+  { "lagged_products"       , (DL_FUNC) & lagged_products       , 13} ,
   { "lagged_products_r"     , (DL_FUNC) & lagged_products_r     , 6 } ,
-  { "fishs_add"             , (DL_FUNC) & fishs_add             , 8 } ,
-  { "fishsr_add"            , (DL_FUNC) & fishsr_add            , 13 } ,
+  { "lagged_products_lags"  , (DL_FUNC) & lagged_products_lags  , 13} ,
+  { "fishs_add"             , (DL_FUNC) & fishs_add             , 9 } ,
+  { "fishsr_add"            , (DL_FUNC) & fishsr_add            , 16 } ,
   { "theory_rows_alloc"     , (DL_FUNC) & theory_rows_alloc     , 13} ,
-  { "theory_rows"           , (DL_FUNC) & theory_rows           , 17} ,
-  { "theory_rows_r"         , (DL_FUNC) & theory_rows_r         , 19} ,
-  { "prepare_data"          , (DL_FUNC) & prepare_data          , 10} ,
+  { "theory_rows"           , (DL_FUNC) & theory_rows           , 19} ,
+  { "theory_rows_r"         , (DL_FUNC) & theory_rows_r         , 21} ,
+  { "theory_rows_f"         , (DL_FUNC) & theory_rows_f         , 21} ,
+  { "theory_rows_fishsr"    , (DL_FUNC) & theory_rows_fishsr    , 20} ,
+  { "cache_sizes"           , (DL_FUNC) & cache_sizes           , 0 } ,
+  { "prepare_data"          , (DL_FUNC) & prepare_data          , 12} ,
+  { "prepare_data_streams"  , (DL_FUNC) & prepare_data_streams  , 13} ,
   { "average_power"         , (DL_FUNC) & average_power         , 6 } ,
-  { "deco_add"              , (DL_FUNC) & deco_add              , 8 } ,
-  { "decor_add"             , (DL_FUNC) & decor_add             , 12 } ,
-  { "average_profile"       , (DL_FUNC) & average_profile       , 4 } ,
+  { "fishsr_solve"          , (DL_FUNC) & fishsr_solve          , 7 } ,
+  { "fishsr_band_width"     , (DL_FUNC) & fishsr_band_width     , 4 } ,
+  { "fishsr_band_solve"     , (DL_FUNC) & fishsr_band_solve     , 7 } ,
+  { "deco_add"              , (DL_FUNC) & deco_add              , 9 } ,
+  { "decor_add"             , (DL_FUNC) & decor_add             , 13 } ,
+  { "average_profile"       , (DL_FUNC) & average_profile       , 9 } ,
   { "dummy_add"             , (DL_FUNC) & dummy_add             , 10} ,
   { "resample"              , (DL_FUNC) & resample              , 8 } ,
   { "resample_R"            , (DL_FUNC) & resample_R            , 8 } ,
-  { "range_ambiguity"       , (DL_FUNC) & range_ambiguity       , 9 } ,
+  { "range_ambiguity"       , (DL_FUNC) & range_ambiguity       , 11} ,
+  { "amb_cache_init"        , (DL_FUNC) & amb_cache_init        , 9 } ,
+  { "amb_cache_get"         , (DL_FUNC) & amb_cache_get         , 4 } ,
+  { "amb_cache_put"         , (DL_FUNC) & amb_cache_put         , 3 } ,
   { "clutter_meas"          , (DL_FUNC) & clutter_meas          , 9 } ,
   { "clutter_subtract"      , (DL_FUNC) & clutter_subtract      , 8 } ,
   { NULL , NULL , 0 }
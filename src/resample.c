@@ -294,3 +294,151 @@ SEXP resample_R( SEXP cdata , SEXP idata , SEXP ndata , SEXP nup , SEXP nfilter
 }
 
 
+/*
+  Polyphase tables for FIR decimation.
+
+  The filter taps are given on the upsampled grid, where each
+  original sample covers nu points. When a filter starts at
+  point p within an original sample, the taps that fall on
+  the same original sample are summed together, giving one
+  table of ntab coefficients for each of the nu phases.
+
+  Arguments:
+   taps     ntaps filter taps on the upsampled grid
+   ntaps    Number of filter taps
+   nu       Upsampling factor
+   ntab     Table length, see resample_fir_ntab
+   g        nu*ntab polyphase coefficients
+   gnz      nu*ntab flags, 1 if the original sample is
+            covered by the filter in the phase
+
+*/
+void resample_fir_tables( const double * taps , const int ntaps , const int nu , const int ntab , double * g , int * gnz )
+{
+  int p, t, m;
+
+  for( m = 0 ; m < ( nu * ntab ) ; ++m ){
+    g[m] = 0.;
+    gnz[m] = 0;
+  }
+
+  for( p = 0 ; p < nu ; ++p ){
+    for( t = 0 ; t < ntaps ; ++t ){
+      m = ( p + t ) / nu;
+      g[ p * ntab + m ] += taps[t];
+      gnz[ p * ntab + m ] = 1;
+    }
+  }
+}
+
+/*
+  Number of original samples covered by a filter
+  of ntaps points on the upsampled grid, with any
+  start point within the first sample.
+*/
+int resample_fir_ntab( const int ntaps , const int nu )
+{
+  return( ( ntaps + 2 * nu - 2 ) / nu );
+}
+
+/*
+  Polyphase FIR decimation of a block of data.
+
+  Output sample l is the sum of taps[t] * x[ ( u + t ) / nu ],
+  t = 0 , ... , ntaps - 1 , where u = i0 + l * nf is the filter
+  start point on the upsampled grid. The boxcar filter of
+  resample is the special case taps = rep(1,nf), apart from
+  the handling of the last partial sample.
+
+  Outputs with equal start phase u % nu are nu / gcd(nf,nu)
+  samples apart, and their inputs are at a constant stride.
+  The sums are thus vectorized over these output samples.
+
+  The index value of an output sample is the number of
+  nonzero input indices within the filter if ipar is set,
+  otherwise it is one if all of them are nonzero. Samples
+  with zero index are set to zero.
+
+  Arguments:
+   xr       Real parts of the input samples
+   xi       Imaginary parts of the input samples
+   xid      Index values of the input samples
+   bs       Index of the original sample in xr[0]
+   g        Polyphase coefficients, see resample_fir_tables
+   gnz      Polyphase coefficient flags
+   ntab     Polyphase table length
+   nu       Upsampling factor
+   nf       Output sample interval on upsampled grid
+   i0       Start point of output sample 0 on upsampled grid
+   l0       First output sample to calculate
+   l1       One past the last output sample to calculate,
+            all inputs of the outputs must be in xr
+   ipar     Partial matches with the filter accepted?
+   accr     Work space of ( l1 - l0 ) doubles
+   acci     Work space of ( l1 - l0 ) doubles
+   accp     Work space of ( l1 - l0 ) integers
+   accs     Work space of ( l1 - l0 ) integers
+   co       Output complex data vector
+   io       Output index vector
+
+*/
+void resample_fir( const double * restrict xr , const double * restrict xi , const int * restrict xid , const int64_t bs , const double * g , const int * gnz , const int ntab , const int nu , const int nf , const int64_t i0 , const int64_t l0 , const int64_t l1 , const int ipar , double * restrict accr , double * restrict acci , int * restrict accp , int * restrict accs , Rcomplex * restrict co , int * restrict io )
+{
+  int64_t q, t, n, u, kb, p, m, l;
+  int64_t np, ns;
+  int64_t a, b, r;
+  double c;
+  const double * restrict xrp;
+  const double * restrict xip;
+  const int * restrict xidp;
+
+  // Number of phases and the input stride
+  a = nf;
+  b = nu;
+  while( b ){
+    r = a % b;
+    a = b;
+    b = r;
+  }
+  np = nu / a;
+  ns = ( np * nf ) / nu;
+
+  for( q = 0 ; ( q < np ) & ( ( l0 + q ) < l1 ) ; ++q ){
+
+    // First output in this phase
+    l  = l0 + q;
+    u  = i0 + l * nf;
+    kb = ( u >= 0 ) ? ( u / nu ) : -( ( nu - 1 - u ) / nu );
+    p  = u - kb * nu;
+    n  = ( l1 - l + np - 1 ) / np;
+
+    for( t = 0 ; t < n ; ++t ){
+      accr[t] = 0.;
+      acci[t] = 0.;
+      accp[t] = 1;
+      accs[t] = 0;
+    }
+
+    for( m = 0 ; m < ntab ; ++m ){
+      if( !gnz[ p * ntab + m ] ) continue;
+      c    = g[ p * ntab + m ];
+      xrp  = xr  + ( kb - bs + m );
+      xip  = xi  + ( kb - bs + m );
+      xidp = xid + ( kb - bs + m );
+#pragma GCC ivdep
+      for( t = 0 ; t < n ; ++t ){
+        accr[t] += c * xrp[ t * ns ];
+        acci[t] += c * xip[ t * ns ];
+        accp[t] &= ( xidp[ t * ns ] != 0 );
+        accs[t] += xidp[ t * ns ];
+      }
+    }
+
+    for( t = 0 ; t < n ; ++t ){
+      io[ l + t * np ] = ipar ? accs[t] : accp[t];
+      co[ l + t * np ].r = io[ l + t * np ] ? accr[t] : .0;
+      co[ l + t * np ].i = io[ l + t * np ] ? acci[t] : .0;
+    }
+  }
+}
+
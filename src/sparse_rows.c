@@ -0,0 +1,139 @@
+// file:sparse_rows.c
+// (c) 2010- University of Oulu, Finland
+// Written by Ilkka Virtanen <ilkka.i.virtanen@oulu.fi>
+// Licensed under FreeBSD license.
+
+#include "LPI.h"
+
+/*
+  Run-length theory rows.
+
+  The non-zero elements of a theory row are in a few
+  continuous runs of range gates, one run per transmitted
+  pulse. A sparse row is stored in the index vector as
+  the number of runs, followed by the first range gate
+  and the length of each run. The values of the runs are
+  stored contiguously in the theory row vectors. The rows
+  are stored one after another in both vectors.
+
+  Arguments:
+   cnt   Index vector of a dense theory row
+   n     Length of the dense row
+   runs  Output vector, must have space for n + 2 values
+
+  Returns:
+   nidx  Number of values written to runs
+
+*/
+
+int sparse_row_runs( const int * cnt , const int n , int * runs )
+{
+  int i;
+  int nrun = 0;
+  int in = 0;
+
+  for( i = 0 ; i < n ; ++i ){
+    if( ( cnt[i] != 0 ) != in ){
+      if( in ){
+        runs[ 2 * nrun + 2 ] = i - runs[ 2 * nrun + 1 ];
+        ++nrun;
+      }else{
+        runs[ 2 * nrun + 1 ] = i;
+      }
+      in = !in;
+    }
+  }
+
+  // Close the last run
+  if( in ){
+    runs[ 2 * nrun + 2 ] = n - runs[ 2 * nrun + 1 ];
+    ++nrun;
+  }
+
+  runs[0] = nrun;
+
+  return( 2 * nrun + 1 );
+}
+
+/*
+  Noise whitening of sparse theory rows and measurements,
+  all stored values of a row are divided with the standard
+  deviation of its measurement.
+
+  Arguments:
+   runs  Index vector of the sparse rows
+   nr    Number of rows
+   var   Measurement variances
+   fR    Single precision theory rows, real part, or NULL
+   fI    Single precision theory rows, imaginary part
+   fmR   Single precision measurements, real part
+   fmI   Single precision measurements, imaginary part
+   aR    Theory rows, real part. Whitened in place if fR
+         is NULL, otherwise the whitened single precision
+         rows are written here.
+   aI    Theory rows, imaginary part
+   mR    Measurements, real part
+   mI    Measurements, imaginary part
+
+*/
+
+void sparse_rows_whiten( const int * runs , const int nr , const double * var , const float * fR , const float * fI , const float * fmR , const float * fmI , double * aR , double * aI , double * mR , double * mI )
+{
+  int64_t v = 0;
+  int64_t v1;
+  int l;
+  int r;
+  int nrun;
+  double std;
+
+  for( l = 0 ; l < nr ; ++l ){
+
+    std = sqrt( var[l] );
+
+    // Total length of the runs of this row
+    nrun = *runs++;
+    v1 = v;
+    for( r = 0 ; r < nrun ; ++r ){
+      v1 += runs[ 2 * r + 1 ];
+    }
+    runs += 2 * nrun;
+
+    if( fR ){
+      for( ; v < v1 ; ++v ){
+        aR[v] = fR[v] / std;
+        aI[v] = fI[v] / std;
+      }
+      mR[l] = fmR[l] / std;
+      mI[l] = fmI[l] / std;
+    }else{
+      for( ; v < v1 ; ++v ){
+        aR[v] /= std;
+        aI[v] /= std;
+      }
+      mR[l] /= std;
+      mI[l] /= std;
+    }
+  }
+}
+
+/*
+  Total number of stored values in nr sparse rows.
+*/
+
+int64_t sparse_rows_nval( const int * runs , const int nr )
+{
+  int64_t nv = 0;
+  int l;
+  int r;
+  int nrun;
+
+  for( l = 0 ; l < nr ; ++l ){
+    nrun = *runs++;
+    for( r = 0 ; r < nrun ; ++r ){
+      nv += runs[ 2 * r + 1 ];
+    }
+    runs += 2 * nrun;
+  }
+
+  return(nv);
+}
@@ -52,6 +52,8 @@ SEXP theory_rows_alloc( SEXP camb , SEXP iamb , SEXP cprod , SEXP iprod , SEXP r
   SEXP mvar;
   SEXP success;
   SEXP nrows;
+  SEXP sparse;
+  SEXP pamb;
   SEXP names;
   int n_rows;
   const char * c_names[6] =  {"arows","irows","m","var","nrows","success"};
@@ -82,9 +84,17 @@ SEXP theory_rows_alloc( SEXP camb , SEXP iamb , SEXP cprod , SEXP iprod , SEXP r
   // Success output
   PROTECT( success = allocVector( LGLSXP , 1 ) );
 
+  // Dense theory rows
+  PROTECT( sparse = ScalarLogical( 0 ) );
+
+  // Pulse list of the range ambiguity function
+  PROTECT( pamb = allocVector( INTSXP , LENGTH(iamb) + 2 ) );
+  INTEGER(pamb)[0] = 0;
+  amb_pulses_add( LOGICAL(iamb) , 0 , LENGTH(iamb) , INTEGER(pamb) );
+
   // Call the theory_rows function to actually make the rows
-  success = theory_rows( camb , iamb , cprod , iprod , rvar , ndata , ncur , nend , rlims ,\
-                         nranges , arows , irows , mvec , mvar , nrows , background , remoterx );
+  success = theory_rows( camb , iamb , pamb , cprod , iprod , rvar , ndata , ncur , nend , rlims ,\
+                         nranges , arows , irows , mvec , mvar , nrows , background , remoterx , sparse );
 
   // Read the row count
   n_rows = *(INTEGER(nrows));
@@ -120,7 +130,7 @@ SEXP theory_rows_alloc( SEXP camb , SEXP iamb , SEXP cprod , SEXP iprod , SEXP r
   setAttrib( ans , R_NamesSymbol , names);
 
 
-  UNPROTECT(7);
+  UNPROTECT(9);
 
   return(ans);
 
@@ -138,6 +148,8 @@ SEXP theory_rows_alloc( SEXP camb , SEXP iamb , SEXP cprod , SEXP iprod , SEXP r
   Arguments:
    camb        Complex range ambiguity functions
    iamb        Index vector of range ambiguity functions
+   pamb        Pulse list of range ambiguity functions, from
+               amb_pulses_add
    cprod       Complex lagged product vector
    iprod       Index vector of lagged products
    rvar        Measurement variance vector
@@ -154,6 +166,10 @@ SEXP theory_rows_alloc( SEXP camb , SEXP iamb , SEXP cprod , SEXP iprod , SEXP r
                this call
    background  0 if additional background term is not used
    remoterx    0 if measurements TX times should not be used
+   sparse      0 if dense rows are stored. Otherwise the
+               non-zero runs of each row are stored in the
+               run-length format of sparse_row_runs, and the
+               call returns early if the buffers are full.
 
   Returns:
    success     0 if no theory rows were produced _and_ end of
@@ -161,10 +177,11 @@ SEXP theory_rows_alloc( SEXP camb , SEXP iamb , SEXP cprod , SEXP iprod , SEXP r
  */
 
 
-SEXP theory_rows( SEXP camb , SEXP iamb , SEXP cprod , SEXP iprod , SEXP rvar , SEXP ndata , SEXP ncur , SEXP nend , SEXP rlims , SEXP nranges , SEXP arows , SEXP irows , SEXP mvec , SEXP mvar , SEXP nrows , SEXP background , SEXP remoterx )
+SEXP theory_rows( SEXP camb , SEXP iamb , SEXP pamb , SEXP cprod , SEXP iprod , SEXP rvar , SEXP ndata , SEXP ncur , SEXP nend , SEXP rlims , SEXP nranges , SEXP arows , SEXP irows , SEXP mvec , SEXP mvar , SEXP nrows , SEXP background , SEXP remoterx , SEXP sparse )
 {
   const Rcomplex * restrict amb = COMPLEX(camb);
   const int * restrict amb_i = LOGICAL(iamb);
+  const int * restrict pulses = INTEGER(pamb);
   const Rcomplex * restrict prod =  COMPLEX(cprod);
   const int * restrict prod_i = LOGICAL(iprod);
   const double * restrict var =  REAL(rvar);
@@ -175,24 +192,37 @@ SEXP theory_rows( SEXP camb , SEXP iamb , SEXP cprod , SEXP iprod , SEXP rvar ,
   const int n_data = *INTEGER(ndata);
   const int bg = *LOGICAL(background);
   const int remrx = *LOGICAL(remoterx);
+  const int sp = *LOGICAL(sparse);
   Rcomplex * restrict a_rows = COMPLEX(arows);
   int * restrict i_rows = LOGICAL(irows);
   Rcomplex * restrict m_vec = COMPLEX(mvec);
   double * restrict m_var = REAL(mvar);
+  Rcomplex * a_out = NULL;
+  int * i_out = NULL;
   SEXP success;
   int * restrict i_success;
   int n_rows;
+  int64_t n_idx = 0;
+  int64_t n_val = 0;
+  R_len_t n_next;
+  int r;
   R_len_t k;
   R_len_t n_start;
   R_len_t i;
   R_len_t j;
-  R_len_t subi;
-  R_len_t addi;
-  R_len_t gati;
   int r_min;
   int r_lim;
   int r_max;
   int r_cur;
+  int ip;
+  int64_t k0 = 0;
+  R_len_t off;
+  double * pR = NULL;
+  double * pI = NULL;
+  int * pc = NULL;
+  int * ps = NULL;
+  int * cur = NULL;
+  int64_t nps = 0;
 
   
   // Check that n_end <= n_data
@@ -210,6 +240,18 @@ SEXP theory_rows( SEXP camb , SEXP iamb , SEXP cprod , SEXP iprod , SEXP rvar ,
   // Set the success output
   *i_success = 1;
 
+  // Sparse rows are formed in a separate work space, only
+  // the non-zero runs are copied to the row buffers
+  if( sp ){
+    a_out = a_rows;
+    i_out = i_rows;
+    a_rows = (Rcomplex*) R_alloc( n_ranges + 1 , sizeof(Rcomplex) );
+    i_rows = (int*) R_alloc( n_ranges + 1 , sizeof(int) );
+  }
+
+  // Position in the data vector after this call
+  n_next = n_end;
+
   // The lowest range gate limnit - 1
   r_min = r_lims[0] - 2 ;
 
@@ -224,95 +266,83 @@ SEXP theory_rows( SEXP camb , SEXP iamb , SEXP cprod , SEXP iprod , SEXP rvar ,
   // The highest range gate limit
   r_max = r_lims[n_ranges] + 1;
 
-  // Make the first theory row.
+  // The first sample
   n_start = n_cur;
   // If we are too close to start of data
   // skip points as necessary
   if( n_start < r_lims[ n_ranges ] ) n_start = r_lims[ n_ranges ];
 
-  // Make sure that we did not yet pass the end point
+  // Cumulative sums of the range ambiguity function over
+  // the pulse samples that the theory rows of this call use
   if( n_start < n_end ){
-    // Go through all range-gates
-    for( i = 0 ; i <  n_ranges ; ++i ){
-      // Initialize the theory matrix to zero
-      a_rows[i].r = .0;
-      a_rows[i].i = .0;
-      i_rows[i] = 0;
-
-      // Add contribution from all ranges
-      // integrated to this gate
-      for( j = r_lims[i] ; j < r_lims[ i + 1 ] ; ++j ){
-
-        // In amb_i == 0 points there might be erroneous
-	// values from previously calculated lags, 
-        // it is thus extremely important to check
-	// amb_i before addition / subtraction!
-        if(amb_i[ n_start - j ]){
-          a_rows[i].r += amb[ n_start - j ].r;
-          a_rows[i].i += amb[ n_start - j ].i;
-          i_rows[i] += amb_i[ n_start - j ];
-        }
-      }
-    }
-
-    // The last gate will be 1 or 0, depending on whether
-    // the background ACF will be suppressed or not.
-    a_rows[ n_ranges ].r = ( bg == 0 ? 0.0 : 1.0);
-    a_rows[ n_ranges ].i = 0.0;
-    i_rows[ n_ranges ]   = ( bg == 0 ? 0 : 1 );
-
-  // If the first row could not be formed
+    k0 = n_start + 1 - r_lims[ n_ranges ];
+    nps = amb_pulses_count( pulses , k0 , n_end - r_lims[0] );
+    pR = (double*) R_alloc( nps + 1 , sizeof(double) );
+    pI = (double*) R_alloc( nps + 1 , sizeof(double) );
+    pc = (int*) R_alloc( nps + 1 , sizeof(int) );
+    ps = (int*) R_alloc( nps + 1 , sizeof(int) );
+    cur = (int*) R_alloc( n_ranges + 1 , sizeof(int) );
+    amb_prefix( amb , NULL , amb_i , pulses , k0 , n_end - r_lims[0] , pR , pI , pc , ps , cur , n_ranges + 1 );
+
+  // If no rows can be formed
   // set success to false and return
   }else{
     *i_success = 0;
   }
 
-  // From this point on all possible theory rows will  be
-  // formed but only those with indprod set are stored,
-  // others are immediately overwritten
-
   // Number of stored rows
   n_rows = 0;
 
-  // Range from the latest pulse
-  r_cur = r_max;
-  for( k = (n_start-r_max) ; k < n_start ; ++k ){
-    if( k >= 0 ){
-      if(amb_i[k]){
-        r_cur = 0;
-      }else{
-        ++r_cur;
-      }
-    }
-  }
+  // Skip the pulses that end before the first sample
+  ip = amb_pulses_first( pulses , n_start );
 
   // Use all data points from n_start to n_end
   for( k = n_start ; k < n_end ; ++k ){
 
-    // If this data point will be used (!=0 for clarity,
-    // the prod_i vector may contains values larger than 1)
-    if( (prod_i[k] != 0) & (r_cur > r_lim) & (r_cur < r_max)){
+    // Only samples with a lagged product are used (!=0 for
+    // clarity, the prod_i vector may contain values larger
+    // than 1)
+    if( prod_i[k] == 0 ) continue;
+
+    // Range from the latest pulse, samples that contain
+    // echoes from below the first gate are excluded
+    r_cur = amb_pulses_since( pulses , &ip , k , r_max );
+    if( (r_cur > r_lim) & (r_cur < r_max)){
+
+      // Stop if a sparse row might not fit in the buffers,
+      // this sample will be the first one in the next call
+      if( sp && ( ( ( n_idx + n_ranges + 3 ) > LENGTH(irows) ) | ( ( n_val + n_ranges + 1 ) > LENGTH(arows) ) ) ){
+        n_next = k;
+        break;
+      }
 
       // Copy data to the measurement vector
       m_vec[n_rows].r = prod[k].r;
       m_vec[n_rows].i = prod[k].i;
       m_var[n_rows]   = var[k];
 
-      // Copy the current theory vectors to the next one.
-      for( i = 0 ; i <  ( n_ranges + 1 ) ; ++i ){
-       	i_rows[ ( n_rows + 1 ) * ( n_ranges + 1 ) + i ]   = i_rows[ n_rows * ( n_ranges + 1 ) + i ];
-        // Set the theory rows exactly to zero at points
-	// where the index vector is zero. This makes 
-	// identification of blind ranges much easier.
-        if(i_rows[ n_rows  * ( n_ranges + 1 ) + i ]==0){
-          a_rows[ ( n_rows + 1 ) * ( n_ranges + 1 ) + i ].r = 0.0;
-          a_rows[ ( n_rows + 1 ) * ( n_ranges + 1 ) + i ].i = 0.0;
-          a_rows[ n_rows * ( n_ranges + 1 ) + i ].r = 0.0;
-          a_rows[ n_rows * ( n_ranges + 1 ) + i ].i = 0.0;
-        // Otherwise copy the theory matrix row
-        }else{
-          a_rows[ ( n_rows + 1 ) * ( n_ranges + 1 ) + i ].r = a_rows[ n_rows * ( n_ranges + 1 ) + i ].r;
-          a_rows[ ( n_rows + 1 ) * ( n_ranges + 1 ) + i ].i = a_rows[ n_rows * ( n_ranges + 1 ) + i ].i;
+      // Theory row of this sample, exactly zero at points
+      // where the index vector is zero. This makes
+      // identification of blind ranges much easier.
+      off = ( sp ? 0 : n_rows * ( n_ranges + 1 ) );
+      amb_prefix_row( pR , pI , pc , ps , nps , cur , k , r_lims , n_ranges , &( a_rows[off].r ) , &( a_rows[off].i ) , 2 , i_rows + off );
+
+      // The last gate will be 1 or 0, depending on whether
+      // the background ACF will be suppressed or not.
+      a_rows[ off + n_ranges ].r = ( bg == 0 ? 0.0 : 1.0);
+      a_rows[ off + n_ranges ].i = 0.0;
+      i_rows[ off + n_ranges ] = ( bg == 0 ? 0 : 1 );
+
+      // Store the non-zero runs of a sparse row
+      if( sp ){
+        j = n_idx;
+        n_idx += sparse_row_runs( i_rows , n_ranges + 1 , i_out + n_idx );
+        for( r = 0 ; r < i_out[j] ; ++r ){
+          for( i = i_out[ j + 2 * r + 1 ] ; i < ( i_out[ j + 2 * r + 1 ] + i_out[ j + 2 * r + 2 ] ) ; ++i ){
+            a_out[ n_val ].r = a_rows[i].r;
+            a_out[ n_val ].i = a_rows[i].i;
+            ++n_val;
+          }
         }
       }
 
@@ -321,49 +351,13 @@ SEXP theory_rows( SEXP camb , SEXP iamb , SEXP cprod , SEXP iprod , SEXP rvar ,
 
     }
 
-    // Now form the next theory row using the previous
-    // one and the range limit indices
-    for( i = 0 ; i < n_ranges ; ++i ){
-      // Index in the theory matrix 
-      // (that is stored as a vector)
-      gati = n_rows * ( n_ranges + 1 ) + i;
-      // Index of the data point that 
-      // will be added to this gate
-      addi = k - r_lims[i] + 1;
-      // Index of the data point that
-      // will be subtracted from this gate
-      subi = k - r_lims[i+1] + 1;
-
-      // Do additions / subtractions only if the point
-      // contains a non-zero ambiguity value
-      if( amb_i[ addi ] ){
-        a_rows[ gati ].r += amb[ addi ].r;
-        a_rows[ gati ].i += amb[ addi ].i;
-        i_rows[ gati ]   += amb_i[ addi ];
-      }
-      if( amb_i[ subi ] ){
-        a_rows[ gati ].r -= amb[ subi ].r;
-        a_rows[ gati ].i -= amb[ subi ].i;
-        i_rows[ gati ]   -= amb_i[ subi ];
-      }
-	
-    }
-
-    // Count samples to exclude everything that contains
-    // echoes from below the first gate
-    if( amb_i[ k ] ){
-      r_cur = 0;
-    }else{
-      ++r_cur;
-    }
-
   }
 
   // Write the row count to the output variable
   *( INTEGER( nrows ) ) = n_rows;
 
   // Update the current position in the data vector
-  *( INTEGER( ncur ) ) = n_end;
+  *( INTEGER( ncur ) ) = n_next;
 
   UNPROTECT(1);
 
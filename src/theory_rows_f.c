@@ -0,0 +1,258 @@
+// file:theory_rows_f.c
+// (c) 2010- University of Oulu, Finland
+// Written by Ilkka Virtanen <ilkka.i.virtanen@oulu.fi>
+// Licensed under FreeBSD license.
+
+
+#include "LPI.h"
+
+/*
+  Make theory matrix rows and measurement vectors
+  in single precision.
+
+  Identical to theory_rows_r, but the range ambiguity
+  functions, lagged products, theory rows and measurements
+  are raw vectors of single precision values. The ambiguity
+  functions and lagged products have interleaved real and
+  imaginary parts. The running sums of the range gates
+  are kept in double precision, only the stored rows
+  are rounded.
+
+  This function overwrites existing data vectors
+
+  Arguments:
+   camb        Range ambiguity functions, 8 bytes per point
+   iamb        Index vector of range ambiguity functions
+   pamb        Pulse list of range ambiguity functions, from
+               amb_pulses_add
+   cprod       Lagged product vector, 8 bytes per point
+   iprod       Index vector of lagged products
+   rvar        Measurement variance vector
+   ndata       Data vector length
+   ncur        Current sample index
+   nend        Last sample index to use (in this call)
+   rlims       Range gate limits
+   nranges     Number of range gates
+   arowsR      Real parts of theory rows
+   arowsI      Imaginary parts of theory rows
+   irows       Theory row indices
+   mvecR       Real part of inversion measurement vector
+   mvecI       Imaginary part of inversion measurement vector
+   mvar        Inversion measurement variances
+   nrows       Number of theory rows produced during
+               this call
+   background  0 if additional background term is not used
+   remoterx    0 if measurements TX times should not be used
+   sparse      0 if dense rows are stored. Otherwise the
+               non-zero runs of each row are stored in the
+               run-length format of sparse_row_runs, and the
+               call returns early if the buffers are full.
+
+  Returns:
+   success     0 if no theory rows were produced _and_ end of
+               data was reached, 1 otherwise
+ */
+
+
+SEXP theory_rows_f( SEXP camb , SEXP iamb , SEXP pamb , SEXP cprod , SEXP iprod , SEXP rvar , SEXP ndata , SEXP ncur , SEXP nend , SEXP rlims , SEXP nranges , SEXP arowsR , SEXP arowsI , SEXP irows , SEXP mvecR , SEXP mvecI , SEXP mvar , SEXP nrows , SEXP background , SEXP remoterx , SEXP sparse )
+{
+  const float * restrict amb = (float*)RAW(camb);
+  const int * restrict amb_i = LOGICAL(iamb);
+  const int * restrict pulses = INTEGER(pamb);
+  const float * restrict prod = (float*)RAW(cprod);
+  const int * restrict prod_i = LOGICAL(iprod);
+  const double * restrict var =  REAL(rvar);
+  int n_cur = *INTEGER(ncur);
+  int n_end = *INTEGER(nend);
+  const int * restrict r_lims = INTEGER(rlims);
+  const int n_ranges = *INTEGER(nranges);
+  const int n_data = *INTEGER(ndata);
+  const int bg = *LOGICAL(background);
+  const int remrx = *LOGICAL(remoterx);
+  const int sp = *LOGICAL(sparse);
+  float * restrict aR = (float*)RAW(arowsR);
+  float * restrict aI = (float*)RAW(arowsI);
+  int * restrict i_rows = LOGICAL(irows);
+  float * restrict mR = (float*)RAW(mvecR);
+  float * restrict mI = (float*)RAW(mvecI);
+  double * restrict m_var = REAL(mvar);
+  double * restrict accR;
+  double * restrict accI;
+  int * s_rows = NULL;
+  SEXP success;
+  int * restrict i_success;
+  int n_rows;
+  int64_t n_idx = 0;
+  int64_t n_val = 0;
+  R_len_t n_next;
+  int r;
+  R_len_t k;
+  R_len_t n_start;
+  R_len_t i;
+  R_len_t j;
+  int r_min;
+  int r_lim;
+  int r_max;
+  int r_cur;
+  int ip;
+  int64_t k0 = 0;
+  R_len_t off;
+  double * pR = NULL;
+  double * pI = NULL;
+  int * pc = NULL;
+  int * ps = NULL;
+  int * cur = NULL;
+  int64_t nps = 0;
+
+
+  // Check that n_end <= n_data
+  n_end = ( n_data > n_end ? n_end : n_data );
+
+  // Check that n_cur <= n_data
+  n_cur = ( n_data > n_cur ? n_cur : n_data );
+
+  // Success output
+  PROTECT( success = allocVector( LGLSXP , 1 ) );
+
+  // Local pointer to the success output
+  i_success = LOGICAL( success );
+
+  // Set the success output
+  *i_success = 1;
+
+  // The current theory row in double precision
+  accR = (double*) R_alloc( n_ranges + 1 , sizeof(double) );
+  accI = (double*) R_alloc( n_ranges + 1 , sizeof(double) );
+
+  // The indices of sparse rows are formed in a separate
+  // work space, only the non-zero runs are copied to the
+  // row buffers
+  if( sp ){
+    s_rows = i_rows;
+    i_rows = (int*) R_alloc( n_ranges + 1 , sizeof(int) );
+  }
+
+  // Position in the data vector after this call
+  n_next = n_end;
+
+  // The lowest range gate limnit - 1
+  r_min = r_lims[0] - 2 ;
+
+  // Samples with non-zero range ambiguity
+  // function at heights below r_lim
+  // will not be used in the theory matrix
+  // Initialize r_min for monostatic reception
+  r_lim = r_min;
+  //  -1 (all samples accpected) for remote reception
+  if( remrx ) r_lim = -1;
+
+  // The highest range gate limit
+  r_max = r_lims[n_ranges] + 1;
+
+  // The first sample
+  n_start = n_cur;
+  // If we are too close to start of data
+  // skip points as necessary
+  if( n_start < r_lims[ n_ranges ] ) n_start = r_lims[ n_ranges ];
+
+  // Cumulative sums of the range ambiguity function over
+  // the pulse samples that the theory rows of this call use
+  if( n_start < n_end ){
+    k0 = n_start + 1 - r_lims[ n_ranges ];
+    nps = amb_pulses_count( pulses , k0 , n_end - r_lims[0] );
+    pR = (double*) R_alloc( nps + 1 , sizeof(double) );
+    pI = (double*) R_alloc( nps + 1 , sizeof(double) );
+    pc = (int*) R_alloc( nps + 1 , sizeof(int) );
+    ps = (int*) R_alloc( nps + 1 , sizeof(int) );
+    cur = (int*) R_alloc( n_ranges + 1 , sizeof(int) );
+    amb_prefix( NULL , amb , amb_i , pulses , k0 , n_end - r_lims[0] , pR , pI , pc , ps , cur , n_ranges + 1 );
+
+  // If no rows can be formed
+  // set success to false and return
+  }else{
+    *i_success = 0;
+  }
+
+  // Number of stored rows
+  n_rows = 0;
+
+  // Skip the pulses that end before the first sample
+  ip = amb_pulses_first( pulses , n_start );
+
+  // Use all data points from n_start to n_end
+  for( k = n_start ; k < n_end ; ++k ){
+
+    // Only samples with a lagged product are used (!=0 for
+    // clarity, the prod_i vector may contain values larger
+    // than 1)
+    if( prod_i[k] == 0 ) continue;
+
+    // Range from the latest pulse, samples that contain
+    // echoes from below the first gate are excluded
+    r_cur = amb_pulses_since( pulses , &ip , k , r_max );
+    if( (r_cur > r_lim) & (r_cur < r_max)){
+
+      // Stop if a sparse row might not fit in the buffers,
+      // this sample will be the first one in the next call
+      if( sp && ( ( ( n_idx + n_ranges + 3 ) > LENGTH(irows) ) | ( ( n_val + n_ranges + 1 ) > ( LENGTH(arowsR) / 4 ) ) ) ){
+        n_next = k;
+        break;
+      }
+
+      // Copy data to the measurement vector
+      mR[n_rows] = prod[ 2 * k ];
+      mI[n_rows] = prod[ 2 * k + 1 ];
+      m_var[n_rows]   = var[k];
+
+      // Theory row of this sample in double precision,
+      // exactly zero at points where the index vector
+      // is zero. This makes identification of blind
+      // ranges much easier.
+      off = ( sp ? 0 : n_rows * ( n_ranges + 1 ) );
+      amb_prefix_row( pR , pI , pc , ps , nps , cur , k , r_lims , n_ranges , accR , accI , 1 , i_rows + off );
+
+      // The last gate will be 1 or 0, depending on whether
+      // the background ACF will be suppressed or not.
+      accR[ n_ranges ] = ( bg == 0 ? 0.0 : 1.0);
+      accI[ n_ranges ] = 0.0;
+      i_rows[ off + n_ranges ] = ( bg == 0 ? 0 : 1 );
+
+      // Store the non-zero runs of a sparse row
+      if( sp ){
+        j = n_idx;
+        n_idx += sparse_row_runs( i_rows , n_ranges + 1 , s_rows + n_idx );
+        for( r = 0 ; r < s_rows[j] ; ++r ){
+          for( i = s_rows[ j + 2 * r + 1 ] ; i < ( s_rows[ j + 2 * r + 1 ] + s_rows[ j + 2 * r + 2 ] ) ; ++i ){
+            aR[ n_val ] = (float)accR[i];
+            aI[ n_val ] = (float)accI[i];
+            ++n_val;
+          }
+        }
+
+      // Round the dense row to single precision
+      }else{
+        for( i = 0 ; i <  ( n_ranges + 1 ) ; ++i ){
+          aR[ off + i ] = (float)accR[i];
+          aI[ off + i ] = (float)accI[i];
+        }
+      }
+
+      // Increment the theory row counter
+      ++n_rows;
+
+    }
+
+  }
+
+  // Write the row count to the output variable
+  *( INTEGER( nrows ) ) = n_rows;
+
+  // Update the current position in the data vector
+  *( INTEGER( ncur ) ) = n_next;
+
+
+  UNPROTECT(1);
+
+  return(success);
+
+}
@@ -0,0 +1,277 @@
+// file:theory_rows_fishsr.c
+// (c) 2010- University of Oulu, Finland
+// Written by Ilkka Virtanen <ilkka.i.virtanen@oulu.fi>
+// Licensed under FreeBSD license.
+
+
+#include "LPI.h"
+
+/*
+  Make theory matrix rows and add them directly to the
+  Fisher information matrix of the fishsr solver.
+
+  The rows are formed as in theory_rows_r, but they are
+  whitened and added to Q and y in panels of FISHSR_PANEL
+  rows, without storing them in the row buffers. All samples from
+  ncur to nend are processed in a single call, the
+  cumulative sums of the range ambiguity function are
+  calculated in blocks of PREFIX_BLOCK samples.
+
+  The range ambiguity functions and lagged products may be
+  either complex vectors or raw vectors of single precision
+  values with interleaved real and imaginary parts.
+
+  Arguments:
+   camb        Range ambiguity functions
+   iamb        Index vector of range ambiguity functions
+   pamb        Pulse list of range ambiguity functions, from
+               amb_pulses_add
+   cprod       Lagged product vector
+   iprod       Index vector of lagged products
+   rvar        Measurement variance vector
+   ndata       Data vector length
+   ncur        Current sample index
+   nend        Last sample index to use
+   rlims       Range gate limits
+   nranges     Number of range gates
+   background  0 if additional background term is not used
+   remoterx    0 if measurements TX times should not be used
+   QvecR       Upper triangular part of the Fisher
+               information matrix, real part
+   QvecI       Imaginary part of QvecR
+   yvecR       Modified measurement vector, real part
+   yvecI       Imaginary part of yvecR
+   flops       Floating point operation counter
+   tile        Tile size of a tiled Q, 0 for the row-packed
+               upper triangle
+   band        Number of stored diagonals of a banded Q, 0 if
+               Q is not banded
+
+  Returns:
+   nrows       Number of theory rows added to the solver
+ */
+
+
+SEXP theory_rows_fishsr( SEXP camb , SEXP iamb , SEXP pamb , SEXP cprod , SEXP iprod , SEXP rvar , SEXP ndata , SEXP ncur , SEXP nend , SEXP rlims , SEXP nranges , SEXP background , SEXP remoterx , SEXP QvecR , SEXP QvecI , SEXP yvecR , SEXP yvecI , SEXP flops , SEXP tile , SEXP band )
+{
+  const Rcomplex * amb = NULL;
+  const float * ambf = NULL;
+  const int * restrict amb_i = LOGICAL(iamb);
+  const int * restrict pulses = INTEGER(pamb);
+  const Rcomplex * prod = NULL;
+  const float * prodf = NULL;
+  const int * restrict prod_i = LOGICAL(iprod);
+  const double * restrict var =  REAL(rvar);
+  int n_cur = *INTEGER(ncur);
+  int n_end = *INTEGER(nend);
+  const int * restrict r_lims = INTEGER(rlims);
+  const int n_ranges = *INTEGER(nranges);
+  const int n_data = *INTEGER(ndata);
+  const int bg = *LOGICAL(background);
+  const int remrx = *LOGICAL(remoterx);
+  double * qR = REAL(QvecR);
+  double * qI = REAL(QvecI);
+  double * yR = REAL(yvecR);
+  double * yI = REAL(yvecI);
+  double * flop_count = REAL(flops);
+  const int tl = *INTEGER(tile);
+  const int bd = *INTEGER(band);
+  double * restrict aR;
+  double * restrict aI;
+  int * restrict i_rows;
+  double * restrict wR;
+  double * restrict wI;
+  int * runs;
+  double * mR;
+  double * mI;
+  double * xR;
+  double * xI;
+  int * xi;
+  double std;
+  int64_t n_adds = 0;
+  int64_t v = 0;
+  int64_t n_idx = 0;
+  int np = 0;
+  SEXP ans;
+  int n_rows;
+  R_len_t k;
+  R_len_t n_start;
+  R_len_t i;
+  R_len_t j;
+  int r_min;
+  int r_lim;
+  int r_max;
+  int r_cur;
+  int ip;
+  int64_t k0 = 0;
+  int64_t k1 = 0;
+  double * pR;
+  double * pI;
+  int * pc;
+  int * ps;
+  int * cur;
+  int64_t nps = 0;
+  int r;
+
+
+  // Check that n_end <= n_data
+  n_end = ( n_data > n_end ? n_end : n_data );
+
+  // Check that n_cur <= n_data
+  n_cur = ( n_data > n_cur ? n_cur : n_data );
+
+  // Single or double precision input
+  if( TYPEOF(camb) == RAWSXP ){
+    ambf = (float*)RAW(camb);
+  }else{
+    amb = COMPLEX(camb);
+  }
+  if( TYPEOF(cprod) == RAWSXP ){
+    prodf = (float*)RAW(cprod);
+  }else{
+    prod = COMPLEX(cprod);
+  }
+
+  // Row count output
+  PROTECT( ans = allocVector( INTSXP , 1 ) );
+
+  // The current theory row and its indices, and the
+  // whitened values, runs and measurements of a panel
+  // of rows to be added
+  aR = (double*) R_alloc( n_ranges + 1 , sizeof(double) );
+  aI = (double*) R_alloc( n_ranges + 1 , sizeof(double) );
+  i_rows = (int*) R_alloc( n_ranges + 1 , sizeof(int) );
+  wR = (double*) R_alloc( (size_t)FISHSR_PANEL * ( n_ranges + 1 ) , sizeof(double) );
+  wI = (double*) R_alloc( (size_t)FISHSR_PANEL * ( n_ranges + 1 ) , sizeof(double) );
+  runs = (int*) R_alloc( (size_t)FISHSR_PANEL * ( n_ranges + 3 ) , sizeof(int) );
+  mR = (double*) R_alloc( FISHSR_PANEL , sizeof(double) );
+  mI = (double*) R_alloc( FISHSR_PANEL , sizeof(double) );
+
+  // Work space of fishsr_add_rows
+  xR = (double*) R_alloc( (size_t)FISHSR_PANEL * ( n_ranges + 1 ) , sizeof(double) );
+  xI = (double*) R_alloc( (size_t)FISHSR_PANEL * ( n_ranges + 1 ) , sizeof(double) );
+  xi = (int*) R_alloc( 2 * ( n_ranges + 1 ) + 2 , sizeof(int) );
+
+  // The lowest range gate limnit - 1
+  r_min = r_lims[0] - 2 ;
+
+  // Samples with non-zero range ambiguity
+  // function at heights below r_lim
+  // will not be used in the theory matrix
+  // Initialize r_min for monostatic reception
+  r_lim = r_min;
+  //  -1 (all samples accpected) for remote reception
+  if( remrx ) r_lim = -1;
+
+  // The highest range gate limit
+  r_max = r_lims[n_ranges] + 1;
+
+  // The first sample
+  n_start = n_cur;
+  // If we are too close to start of data
+  // skip points as necessary
+  if( n_start < r_lims[ n_ranges ] ) n_start = r_lims[ n_ranges ];
+
+  // Number of added rows
+  n_rows = 0;
+
+  // Nothing to do if we already passed the end point
+  if( n_start >= n_end ){
+    *INTEGER(ans) = n_rows;
+    UNPROTECT(1);
+    return(ans);
+  }
+
+  // The last gate will be 1 or 0, depending on whether
+  // the background ACF will be suppressed or not.
+  aR[ n_ranges ] = ( bg == 0 ? 0.0 : 1.0);
+  aI[ n_ranges ] = 0.0;
+  i_rows[ n_ranges ]   = ( bg == 0 ? 0 : 1 );
+
+  // Cumulative sums of the range ambiguity function over
+  // the pulse samples of a block of rows
+  pR = (double*) R_alloc( PREFIX_BLOCK + r_lims[ n_ranges ] - r_lims[0] , sizeof(double) );
+  pI = (double*) R_alloc( PREFIX_BLOCK + r_lims[ n_ranges ] - r_lims[0] , sizeof(double) );
+  pc = (int*) R_alloc( PREFIX_BLOCK + r_lims[ n_ranges ] - r_lims[0] , sizeof(int) );
+  ps = (int*) R_alloc( PREFIX_BLOCK + r_lims[ n_ranges ] - r_lims[0] , sizeof(int) );
+  cur = (int*) R_alloc( n_ranges + 1 , sizeof(int) );
+
+  // Skip the pulses that end before the first sample
+  ip = amb_pulses_first( pulses , n_start );
+
+  // Use all data points from n_start to n_end
+  for( k = n_start ; k < n_end ; ++k ){
+
+    // Only samples with a lagged product are used (!=0 for
+    // clarity, the prod_i vector may contain values larger
+    // than 1)
+    if( prod_i[k] == 0 ) continue;
+
+    // Range from the latest pulse, samples that contain
+    // echoes from below the first gate are excluded
+    r_cur = amb_pulses_since( pulses , &ip , k , r_max );
+    if( (r_cur > r_lim) & (r_cur < r_max)){
+
+      // Cumulative sums for a new block of samples
+      if( k >= k1 ){
+        k0 = k + 1 - r_lims[ n_ranges ];
+        k1 = ( ( k + PREFIX_BLOCK ) < n_end ? ( k + PREFIX_BLOCK ) : n_end );
+        nps = amb_prefix( amb , ambf , amb_i , pulses , k0 , k1 - r_lims[0] , pR , pI , pc , ps , cur , n_ranges + 1 );
+      }
+
+      // Theory row of this sample, exactly zero at points
+      // where the index vector is zero
+      amb_prefix_row( pR , pI , pc , ps , nps , cur , k , r_lims , n_ranges , aR , aI , 1 , i_rows );
+
+      // Noise whitening of the measurement
+      std = sqrt( var[k] );
+      complex_load( prod , prodf , k , mR + np , mI + np );
+      mR[np] /= std;
+      mI[np] /= std;
+
+      // Whitened non-zero runs of the current row
+      i = n_idx;
+      n_idx += sparse_row_runs( i_rows , n_ranges + 1 , runs + n_idx );
+      for( r = 0 ; r < runs[i] ; ++r ){
+        for( j = runs[ i + 2 * r + 1 ] ; j < ( runs[ i + 2 * r + 1 ] + runs[ i + 2 * r + 2 ] ) ; ++j ){
+          wR[v] = aR[j] / std;
+          wI[v] = aI[j] / std;
+          ++v;
+        }
+      }
+      ++np;
+
+      // Add a full panel of rows to the Fisher information matrix
+      if( np == FISHSR_PANEL ){
+        n_adds += fishsr_add_rows( qR , qI , yR , yI , wR , wI , runs , mR , mI , n_ranges + 1 , np , xR , xI , xi , tl , bd );
+        np = 0;
+        v = 0;
+        n_idx = 0;
+      }
+
+      // Increment the theory row counter
+      ++n_rows;
+
+    }
+
+  }
+
+  // Add the last rows
+  if( np > 0 ){
+    n_adds += fishsr_add_rows( qR , qI , yR , yI , wR , wI , runs , mR , mI , n_ranges + 1 , np , xR , xI , xi , tl , bd );
+  }
+
+  // total number of floating point operations.
+  *flop_count += 8.*((double)(n_adds));
+
+  // Write the row count to the output variable
+  *INTEGER(ans) = n_rows;
+
+  // Update the current position in the data vector
+  *( INTEGER( ncur ) ) = n_end;
+
+  UNPROTECT(1);
+
+  return(ans);
+
+}
@@ -14,6 +14,8 @@
   Arguments:
    camb        Complex range ambiguity functions
    iamb        Index vector of range ambiguity functions
+   pamb        Pulse list of range ambiguity functions, from
+               amb_pulses_add
    cprod       Complex lagged product vector
    iprod       Index vector of lagged products
    rvar        Measurement variance vector
@@ -30,6 +32,10 @@
                this call
    background  0 if additional background term is not used
    remoterx    0 if measurements TX times should not be used
+   sparse      0 if dense rows are stored. Otherwise the
+               non-zero runs of each row are stored in the
+               run-length format of sparse_row_runs, and the
+               call returns early if the buffers are full.
 
   Returns:
    success     0 if no theory rows were produced _and_ end of
@@ -37,10 +43,11 @@
  */
 
 
-SEXP theory_rows_r( SEXP camb , SEXP iamb , SEXP cprod , SEXP iprod , SEXP rvar , SEXP ndata , SEXP ncur , SEXP nend , SEXP rlims , SEXP nranges , SEXP arowsR , SEXP arowsI , SEXP irows , SEXP mvecR , SEXP mvecI , SEXP mvar , SEXP nrows , SEXP background , SEXP remoterx )
+SEXP theory_rows_r( SEXP camb , SEXP iamb , SEXP pamb , SEXP cprod , SEXP iprod , SEXP rvar , SEXP ndata , SEXP ncur , SEXP nend , SEXP rlims , SEXP nranges , SEXP arowsR , SEXP arowsI , SEXP irows , SEXP mvecR , SEXP mvecI , SEXP mvar , SEXP nrows , SEXP background , SEXP remoterx , SEXP sparse )
 {
   const Rcomplex * restrict amb = COMPLEX(camb);
   const int * restrict amb_i = LOGICAL(iamb);
+  const int * restrict pulses = INTEGER(pamb);
   const Rcomplex * restrict prod =  COMPLEX(cprod);
   const int * restrict prod_i = LOGICAL(iprod);
   const double * restrict var =  REAL(rvar);
@@ -51,26 +58,40 @@ SEXP theory_rows_r( SEXP camb , SEXP iamb , SEXP cprod , SEXP iprod , SEXP rvar
   const int n_data = *INTEGER(ndata);
   const int bg = *LOGICAL(background);
   const int remrx = *LOGICAL(remoterx);
+  const int sp = *LOGICAL(sparse);
   double * restrict aR = REAL(arowsR);
   double * restrict aI = REAL(arowsI);
   int * restrict i_rows = LOGICAL(irows);
   double * restrict mR = REAL(mvecR);
   double * restrict mI = REAL(mvecI);
   double * restrict m_var = REAL(mvar);
+  double * sR = NULL;
+  double * sI = NULL;
+  int * s_rows = NULL;
   SEXP success;
   int * restrict i_success;
   int n_rows;
+  int64_t n_idx = 0;
+  int64_t n_val = 0;
+  R_len_t n_next;
+  int r;
   R_len_t k;
   R_len_t n_start;
   R_len_t i;
   R_len_t j;
-  R_len_t subi;
-  R_len_t addi;
-  R_len_t gati;
   int r_min;
   int r_lim;
   int r_max;
   int r_cur;
+  int ip;
+  int64_t k0 = 0;
+  R_len_t off;
+  double * pR = NULL;
+  double * pI = NULL;
+  int * pc = NULL;
+  int * ps = NULL;
+  int * cur = NULL;
+  int64_t nps = 0;
 
   
   // Check that n_end <= n_data
@@ -88,6 +109,20 @@ SEXP theory_rows_r( SEXP camb , SEXP iamb , SEXP cprod , SEXP iprod , SEXP rvar
   // Set the success output
   *i_success = 1;
 
+  // Sparse rows are formed in a separate work space, only
+  // the non-zero runs are copied to the row buffers
+  if( sp ){
+    sR = aR;
+    sI = aI;
+    s_rows = i_rows;
+    aR = (double*) R_alloc( n_ranges + 1 , sizeof(double) );
+    aI = (double*) R_alloc( n_ranges + 1 , sizeof(double) );
+    i_rows = (int*) R_alloc( n_ranges + 1 , sizeof(int) );
+  }
+
+  // Position in the data vector after this call
+  n_next = n_end;
+
   // The lowest range gate limnit - 1
   r_min = r_lims[0] - 2 ;
 
@@ -102,95 +137,83 @@ SEXP theory_rows_r( SEXP camb , SEXP iamb , SEXP cprod , SEXP iprod , SEXP rvar
   // The highest range gate limit
   r_max = r_lims[n_ranges] + 1;
 
-  // Make the first theory row.
+  // The first sample
   n_start = n_cur;
   // If we are too close to start of data
   // skip points as necessary
   if( n_start < r_lims[ n_ranges ] ) n_start = r_lims[ n_ranges ];
 
-  // Make sure that we did not yet pass the end point
+  // Cumulative sums of the range ambiguity function over
+  // the pulse samples that the theory rows of this call use
   if( n_start < n_end ){
-    // Go through all range-gates
-    for( i = 0 ; i <  n_ranges ; ++i ){
-      // Initialize the theory matrix to zero
-      aR[i] = .0;
-      aI[i] = .0;
-      i_rows[i] = 0;
-
-      // Add contribution from all ranges
-      // integrated to this gate
-      for( j = r_lims[i] ; j < r_lims[ i + 1 ] ; ++j ){
-
-        // In amb_i == 0 points there might be erroneous
-	// values from previously calculated lags, 
-        // it is thus extremely important to check
-	// amb_i before addition / subtraction!
-        if(amb_i[ n_start - j ]){
-          aR[i] += amb[ n_start - j ].r;
-          aI[i] += amb[ n_start - j ].i;
-          i_rows[i] += amb_i[ n_start - j ];
-        }
-      }
-    }
-
-    // The last gate will be 1 or 0, depending on whether
-    // the background ACF will be suppressed or not.
-    aR[ n_ranges ] = ( bg == 0 ? 0.0 : 1.0);
-    aI[ n_ranges ] = 0.0;
-    i_rows[ n_ranges ]   = ( bg == 0 ? 0 : 1 );
-
-  // If the first row could not be formed
+    k0 = n_start + 1 - r_lims[ n_ranges ];
+    nps = amb_pulses_count( pulses , k0 , n_end - r_lims[0] );
+    pR = (double*) R_alloc( nps + 1 , sizeof(double) );
+    pI = (double*) R_alloc( nps + 1 , sizeof(double) );
+    pc = (int*) R_alloc( nps + 1 , sizeof(int) );
+    ps = (int*) R_alloc( nps + 1 , sizeof(int) );
+    cur = (int*) R_alloc( n_ranges + 1 , sizeof(int) );
+    amb_prefix( amb , NULL , amb_i , pulses , k0 , n_end - r_lims[0] , pR , pI , pc , ps , cur , n_ranges + 1 );
+
+  // If no rows can be formed
   // set success to false and return
   }else{
     *i_success = 0;
   }
 
-  // From this point on all possible theory rows will  be
-  // formed but only those with indprod set are stored,
-  // others are immediately overwritten
-
   // Number of stored rows
   n_rows = 0;
 
-  // Range from the latest pulse
-  r_cur = r_max;
-  for( k = (n_start-r_max) ; k < n_start ; ++k ){
-    if( k >= 0 ){
-      if(amb_i[k]){
-        r_cur = 0;
-      }else{
-        ++r_cur;
-      }
-    }
-  }
+  // Skip the pulses that end before the first sample
+  ip = amb_pulses_first( pulses , n_start );
 
   // Use all data points from n_start to n_end
   for( k = n_start ; k < n_end ; ++k ){
 
-    // If this data point will be used (!=0 for clarity,
-    // the prod_i vector may contains values larger than 1)
-    if( (prod_i[k] != 0) & (r_cur > r_lim) & (r_cur < r_max)){
+    // Only samples with a lagged product are used (!=0 for
+    // clarity, the prod_i vector may contain values larger
+    // than 1)
+    if( prod_i[k] == 0 ) continue;
+
+    // Range from the latest pulse, samples that contain
+    // echoes from below the first gate are excluded
+    r_cur = amb_pulses_since( pulses , &ip , k , r_max );
+    if( (r_cur > r_lim) & (r_cur < r_max)){
+
+      // Stop if a sparse row might not fit in the buffers,
+      // this sample will be the first one in the next call
+      if( sp && ( ( ( n_idx + n_ranges + 3 ) > LENGTH(irows) ) | ( ( n_val + n_ranges + 1 ) > LENGTH(arowsR) ) ) ){
+        n_next = k;
+        break;
+      }
 
       // Copy data to the measurement vector
       mR[n_rows] = prod[k].r;
       mI[n_rows] = prod[k].i;
       m_var[n_rows]   = var[k];
 
-      // Copy the current theory vectors to the next one.
-      for( i = 0 ; i <  ( n_ranges + 1 ) ; ++i ){
-       	i_rows[ ( n_rows + 1 ) * ( n_ranges + 1 ) + i ]   = i_rows[ n_rows * ( n_ranges + 1 ) + i ];
-        // Set the theory rows exactly to zero at points
-	// where the index vector is zero. This makes 
-	// identification of blind ranges much easier.
-        if(i_rows[ n_rows  * ( n_ranges + 1 ) + i ]==0){
-          aR[ ( n_rows + 1 ) * ( n_ranges + 1 ) + i ] = 0.0;
-          aI[ ( n_rows + 1 ) * ( n_ranges + 1 ) + i ] = 0.0;
-          aR[ n_rows * ( n_ranges + 1 ) + i ] = 0.0;
-          aI[ n_rows * ( n_ranges + 1 ) + i ] = 0.0;
-        // Otherwise copy the theory matrix row
-        }else{
-          aR[ ( n_rows + 1 ) * ( n_ranges + 1 ) + i ] = aR[ n_rows * ( n_ranges + 1 ) + i ];
-          aI[ ( n_rows + 1 ) * ( n_ranges + 1 ) + i ] = aI[ n_rows * ( n_ranges + 1 ) + i ];
+      // Theory row of this sample, exactly zero at points
+      // where the index vector is zero. This makes
+      // identification of blind ranges much easier.
+      off = ( sp ? 0 : n_rows * ( n_ranges + 1 ) );
+      amb_prefix_row( pR , pI , pc , ps , nps , cur , k , r_lims , n_ranges , aR + off , aI + off , 1 , i_rows + off );
+
+      // The last gate will be 1 or 0, depending on whether
+      // the background ACF will be suppressed or not.
+      aR[ off + n_ranges ] = ( bg == 0 ? 0.0 : 1.0);
+      aI[ off + n_ranges ] = 0.0;
+      i_rows[ off + n_ranges ] = ( bg == 0 ? 0 : 1 );
+
+      // Store the non-zero runs of a sparse row
+      if( sp ){
+        j = n_idx;
+        n_idx += sparse_row_runs( i_rows , n_ranges + 1 , s_rows + n_idx );
+        for( r = 0 ; r < s_rows[j] ; ++r ){
+          for( i = s_rows[ j + 2 * r + 1 ] ; i < ( s_rows[ j + 2 * r + 1 ] + s_rows[ j + 2 * r + 2 ] ) ; ++i ){
+            sR[ n_val ] = aR[i];
+            sI[ n_val ] = aI[i];
+            ++n_val;
+          }
         }
       }
 
@@ -199,49 +222,13 @@ SEXP theory_rows_r( SEXP camb , SEXP iamb , SEXP cprod , SEXP iprod , SEXP rvar
 
     }
 
-    // Now form the next theory row using the previous
-    // one and the range limit indices
-    for( i = 0 ; i < n_ranges ; ++i ){
-      // Index in the theory matrix 
-      // (that is stored as a vector)
-      gati = n_rows * ( n_ranges + 1 ) + i;
-      // Index of the data point that 
-      // will be added to this gate
-      addi = k - r_lims[i] + 1;
-      // Index of the data point that
-      // will be subtracted from this gate
-      subi = k - r_lims[i+1] + 1;
-
-      // Do additions / subtractions only if the point
-      // contains a non-zero ambiguity value
-      if( amb_i[ addi ] ){
-        aR[ gati ] += amb[ addi ].r;
-        aI[ gati ] += amb[ addi ].i;
-        i_rows[ gati ]   += amb_i[ addi ];
-      }
-      if( amb_i[ subi ] ){
-        aR[ gati ] -= amb[ subi ].r;
-        aI[ gati ] -= amb[ subi ].i;
-        i_rows[ gati ]   -= amb_i[ subi ];
-      }
-	
-    }
-
-    // Count samples to exclude everything that contains
-    // echoes from below the first gate
-    if( amb_i[ k ] ){
-      r_cur = 0;
-    }else{
-      ++r_cur;
-    }
-
   }
 
   // Write the row count to the output variable
   *( INTEGER( nrows ) ) = n_rows;
 
   // Update the current position in the data vector
-  *( INTEGER( ncur ) ) = n_end;
+  *( INTEGER( ncur ) ) = n_next;
 
   
   UNPROTECT(1);